@@ -13,17 +13,51 @@
 // Includes
 // {{{
 
+#ifdef TESTING
+#define _GNU_SOURCE     /* posix_openpt() and friends on glibc */
+#endif
+
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
 
 #ifdef TESTING
 #include <time.h>
 #include <stdlib.h>
-#include <string.h>
 #include <unistd.h>
 #include <sys/select.h>
 #include <termios.h>
-#include <ctype.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#else
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#ifdef BENCHMARK
+#include <avr/sleep.h>
+#include "avr_mcu_section.h"        // simavr console register
+#endif
+#endif
+
+#ifdef TESTING
+// flash strings are plain memory on the host
+#define PROGMEM
+#define PSTR(s)             (s)
+#define pgm_read_byte(p)    (*(const uint8_t *)(p))
+#define pgm_read_word(p)    (*(const uint16_t *)(p))
+#define printf_P            printf
+#define strncpy_P           strncpy
 #endif
 
 // }}}
@@ -35,7 +69,8 @@
 
 // bit 0    reserved
 // bit 1    0=6 digits, 1=7 digits
-// bit 2..4 0=frequency, 1=period, 2=pulsehi, 3=pulselow, 4=event
+// bit 2..4 0=frequency, 1=period, 2=pulsehi, 3=pulselow, 4=event,
+//          5=ratio A/B, 6=time interval A->B, 7=burst
 // bit 5    0= <100Mhz 1= >100MHz
 // bit 6    0= analog, 1=digital
 // bit 7    reserved
@@ -50,33 +85,190 @@
 #define PULSEHI     0x08
 #define PULSELO     0x0C
 #define EVENT       0x10
+#define RATIO       0x14
+#define INTERVAL    0x18
+#define BURST       0x1C
+#define DUALMODE(r) ((((r) & MASK_MODE) == RATIO) || (((r) & MASK_MODE) == INTERVAL))
 
 #define MASK_INPUT  0x60
 #define MHZ         0x00
 #define GHZ         0x20
 #define DIGITAL     0x40
 
-#define MEASURCNT 7
-char *measurements[] = { 
+// Regression estimator
+// samples are taken every Stride prescaled input edges, the prescaler is
+// chosen so that captured edges are at least REG_MIN_SPACING timebase
+// ticks apart (capture interrupt budget). The CPU runs from the timebase,
+// a tick is one CPU cycle.
+#define REG_MIN_SPACING 256
+#define REG_MAX_SAMPLES 65535
+// Channel B is timestamped in software by INT0: the entry takes
+// INT0_LATENCY ticks plus at most 3 for the instruction in progress. An
+// edge that comes in while another handler runs waits for all of it;
+// such entries follow that handler's return (IsrDone) by less than
+// INT0_HOLDOFF and are not used for A->B intervals.
+#define INT0_LATENCY    13          // channel B interrupt entry, timebase ticks, see
+                                    // int0Latency in make avr-bench
+#define INT0_HOLDOFF    77          // handler epilogue plus INT0 entry
+// In RATIO/INTERVAL both capture interrupts share the budget: channel A
+// captures are DUAL_MIN_SPACING apart and channel B may not be faster,
+// about 19.5 kHz. A B edge closer than that to the previous one (less a
+// late timestamp) switches INT0 off for the rest of the gate and the
+// reading is left blank.
+#define DUAL_MIN_SPACING (2 * REG_MIN_SPACING)
+
+// Burst mode, a gap longer than BURST_GAP ends a burst; the sub-gate
+// inside each burst opens BurstDelay after its first edge and lasts
+// BurstWidth (0 = to the end of the burst). On the front panel a long
+// Setup press steps through BURST_PRESETS delay/width pairs, holding it
+// keeps stepping.
+#define BURST_GAP       1000        // ticks, 100 us
+#define BURST_PRESETS   6
+
+// Adaptive gate
+// the gate is sized so the predicted resolution is GATE_MARGIN times
+// better than one count in the last requested digit
+#define GATE_MIN_TICKS  (TIMEBASE_FREQUENCY / 100)
+#define GATE_MAX_TICKS  (TIMEBASE_FREQUENCY * 10)
+#define GATE_MARGIN     2.0
+#define NOISE_FLOOR     0.2887      // quantisation noise, 1/sqrt(12) tick
+
+// Hold capture buffer
+// edge timestamps are stored as zigzag varints of the change in period,
+// a stable signal costs one byte per edge
+#define CAPTURE_BYTES   768
+#define VARINT_MAX      5
+
+// Binary stream
+// frame: SYNC, type, length, payload, crc16 (ccitt, over type..payload)
+// multi byte fields are little endian
+#define TXBUF_SIZE      256         // uint8_t head/tail wrap by themselves
+#define STREAM_SYNC     0xA5
+#define FRAME_READING   0x01
+#define FRAME_CAPTURE   0x02
+#define FRAME_OVERHEAD  5
+#define READING_LEN     30
+#define CAPTURE_CHUNK   32
+#define STREAM_BAUD     115200
+
+// Persistent state
+// EE_SLOTS records written round robin, the newest valid record is the one
+// whose successor does not carry the next sequence number
+#define EE_BASE         0
+#define EE_SLOTS        32
+#define EE_SLOT_SIZE    8           // seq, cmdreg, divider, period(4), crc
+#define EE_SIZE         (EE_SLOTS * EE_SLOT_SIZE)
+#define EE_SETTLE       200         // centiseconds without a change before a write
+
+#ifdef BENCHMARK
+// Cycle benchmark (make avr-bench), synthetic 48 kHz input at prescaler 2
+#define BENCH_SAMPLES   256
+#define BENCH_PERIOD    416UL       // timestamps are 32 bit, n is not
+#endif
+
+// Front panel keys, scanned every timer0 tick (10 ms). A key counts as
+// down once its integrator reaches KEY_INTEGRATE and as up again at 0.
+#define KEYCNT          3
+#define KEY_INTEGRATE   4
+#define KEY_LONG        100         // ticks until the long press event
+#define KEY_REPEAT_DELAY 50         // ticks from the long press to the first repeat
+#define KEY_REPEAT      15          // ticks between repeats
+#define KEY_QUEUE       8
+#define KEY_F_REPEAT    0x01        // with KEY_F_LONG: the long press repeats while held
+#define KEY_F_LONG      0x02        // press on release, long press after KEY_LONG
+
+#ifndef TESTING
+// HD44780 40x2 in 4 bit mode, D4..D7 on PC0..PC3, RS on PC4, E on PC5.
+// Each LCD line shows one layout row from LCD_COL0 on, the rest of the
+// layout is clipped. Timer2 ticks every LCD_TICK_US while there is work.
+#define LCD_ROWS        2
+#define LCD_COLS        40
+#define LCD_LINE0       6           // layout VALUELINE: mode, value, unit
+#define LCD_LINE1       8           // layout VALUELINE+2: hold statistics
+#define LCD_COL0        18
+#define LCD_QUEUE       16
+#define LCD_TICK_US     50          // longer than the 37 us instruction time
+#define LCD_RS          0x100       // queue entry is data
+#define LCD_NIBBLE      0x200       // queue entry is a single init nibble
+#define LCD_POWERUP     (40000 / LCD_TICK_US)
+#define LCD_INIT_WAIT   (5000 / LCD_TICK_US)
+#define LCD_CLEAR_WAIT  (1600 / LCD_TICK_US)
+#endif
+
+#ifdef TESTING
+// Simulator output modes, OUT_CSV and OUT_JSON print one record per
+// reading and skip all layout/display emulator output
+#define OUT_TUI         0
+#define OUT_CSV         1
+#define OUT_JSON        2
+#define WRBUF_SIZE      65536
+
+// Terminal writer, TUI frames are queued whole and written by their own
+// thread so a slow terminal never holds up the measurement
+#define TERM_SLOTS      4
+#define TERM_FRAME      16384       // bytes, a full repaint is about 3 KB
+
+// Simulator clock, the virtual time follows the wall clock (times SimSpeed)
+// or jumps straight to the next gate close
+#define SIM_REALTIME    0
+#define SIM_FAST        1
+#define SIM_JUMP        2
+
+// Simulated front panel, terminal keys 1..3 press the keys for
+// SIM_KEY_SHORT ticks, ! @ # hold them for SIM_KEY_HOLD
+#define SIM_KEY_SHORT   15          // timer0 ticks, a short press
+#define SIM_KEY_HOLD    200         // long press, Setup repeats
+
+// Ring file recorder, fixed size records in a memory mapped file
+#define RING_MAGIC      "RCRING01"
+#define RING_PAYLOAD    48
+#define RING_RECORDS    65536       // default capacity, 4 MB
+#define RING_EDGES      0x10        // record type for raw edge timestamps
+#define RING_EDGE_MAX   11          // timestamps per edge record
+
+// Jitter analysis of edge timestamps
+#define JIT_BINS        32          // period histogram
+#define JIT_FREQS       32          // periodogram, up to half the edge rate
+#define JIT_SEGMENT     (2 * JIT_FREQS)
+
+// Render cost harness (make render-bench)
+#define RENDER_READINGS 20          // reading frames per mode
+#endif
+
+#define MEASURCNT 10
+// String tables live in flash, read them through layo_puts_P()
+const char measurements[MEASURCNT][12] PROGMEM = { 
                         "| Meeting |",
                         "|         |",
                         "| Freq    |", 
                         "| Per     |", 
                         "| pHi     |", 
                         "| pLo     |",
-                        "| Evt     |"};
-
-#define MODECNT 5
-char *ModeString[] = {  "Freq     ", 
+                        "| Evt     |",
+                        "| A/B     |",
+                        "| A->B    |",
+                        "| Burst   |"};
+
+#define MODECNT 8
+const char ModeString[MODECNT][10] PROGMEM = {
+                        "Freq     ", 
                         "Period   ", 
                         "Pos Pulse", 
                         "Neg Pulse",
-                        "Events   " };
+                        "Events   ",
+                        "Ratio A/B",
+                        "Int A->B ",
+                        "Burst    " };
+// burst sub-gate delay and width in us, 0/0 is the whole burst
+const uint16_t BurstPresets[BURST_PRESETS][2] PROGMEM = {
+                        { 0, 0 }, { 10, 20 }, { 20, 50 },
+                        { 50, 100 }, { 100, 200 }, { 200, 1000 } };
 #define UNITCNT  10
-char *UnitString[] = {  "mHz  ", "Hz   ", "kHz  ", "MHz  ", "GHz  ", 
+const char UnitString[UNITCNT][6] PROGMEM = {
+                        "mHz  ", "Hz   ", "kHz  ", "MHz  ", "GHz  ", 
                         "ns   ", "us   ", "ms   ", "sec  ", "     " };
 #define INPUTCNT 5
-char *InputString[] = {  
+const char InputString[INPUTCNT][12] PROGMEM = {  
                         "| Input   |",
                         "|         |",
                         "| 1.2 GHz |", 
@@ -90,6 +282,9 @@ char *InputString[] = {
 #define cPULSEHI    'h'
 #define cPULSELO    'l'
 #define cEVENT      'e'
+#define cRATIO      'r'
+#define cINTERVAL   'i'
+#define cBURST      'u'
 #define iGHZ        'g'
 #define iMHz        'm'
 #define iDIGITAL    'd'
@@ -98,6 +293,12 @@ char *InputString[] = {
 #define bSETUP      'b'
 #define bHOLD       'c'
 
+// Commands generated by the front panel keys only
+#define kMODE       0x11        // next measurement mode
+#define kINPUT      0x12        // next input
+#define kDIGITS     0x13        // toggle 6/7 digits
+#define kRESTART    0x14        // restart the hold capture
+
 #ifdef TESTING
 #define bQUIT       'q'
 #endif
@@ -106,23 +307,274 @@ char *InputString[] = {
 // }}}
 // Globals
 // {{{
-uint8_t     ExitMainLoop=FALSE;
+volatile uint8_t ExitMainLoop=FALSE;
 uint16_t    CommandRegisterChanged=TRUE;
 uint8_t     CommandRegister=P6DIGITS + FREQUENCY + MHZ;
-uint64_t    GateTimeTest;
-uint64_t    GateTimeFinal;
-uint64_t    TimeBasePulsTest=-2;
-uint64_t    TimeBasePulsFinal=-2;
-uint64_t    CounterValue=0;
-uint64_t    DisplayValue=1;
-uint64_t    PortPrescaler=0;
-uint8_t     DividerSetting=0;
-uint32_t    PrevValue=0;
-int         Precision=6;
 uint32_t    OurTime=0;
 
+// Regression accumulators, t[k] relative to the first sample
+struct regression
+{
+    uint16_t    N;
+    uint16_t    Stride;
+    uint32_t    T0;
+    uint32_t    TLast;
+    uint64_t    SumT;
+    uint64_t    SumP;                   // sum of the running SumT
+} __attribute__((packed));
+
+// Measurement state, fields sized for the 8 bit core
+struct measurement
+{
+    uint32_t    GateTimeFinal;          // ticks
+    uint32_t    TimeBasePulsTest;       // input period, ticks
+    uint32_t    TimeBasePulsTestB;      // channel B period, ticks
+    uint32_t    TimeBasePulsFinal;      // span of the final gate, ticks
+    uint32_t    CounterValue;
+    uint32_t    DisplayValue;
+    uint32_t    PrevValue;
+    uint32_t    PortPrescaler;
+    uint64_t    FrequencyMilliHz;
+    uint64_t    PrevFrequencyMilliHz;
+    float       NoiseTicks;             // rms timestamp noise estimate
+    uint8_t     DividerSetting;
+    uint8_t     Precision;
+    int8_t      DecimalPosition;
+    uint8_t     UnitIndex;
+    uint8_t     ValueValid;             // FALSE: the mode is not measured, no value
+    uint8_t     RangeValid;
+    struct regression Reg;              // channel A
+    // channel B, ratio and time interval modes
+    struct regression RegB;             // no hardware prescaler
+    uint64_t    FrequencyBMilliHz;
+    uint64_t    IntervalSum;            // ticks from the last A to each B
+    uint32_t    IntervalN;
+    uint16_t    IntervalLate;           // B timestamps held off, not paired
+    uint8_t     BTooFast;               // B above the DUAL_MIN_SPACING rate
+    uint32_t    BurstGap;               // ticks
+    uint32_t    BurstDelay;
+    uint32_t    BurstWidth;
+    uint32_t    BurstEdges;             // prescaled periods inside the sub-gates
+    uint64_t    BurstTicks;             // and their total length
+    uint16_t    BurstSpans;             // sub-gates in those sums
+    uint16_t    Bursts;
+    float       BurstRate;              // sub-gates per tick, last final gate
+    float       BurstDuty;              // sub-gate ticks per tick
+} __attribute__((packed)) Meas =
+{
+    .DisplayValue = 1,
+    .BurstGap = BURST_GAP,
+    .NoiseTicks = 4*NOISE_FLOOR,
+    .Precision = 6,
+    .DecimalPosition = 3,
+    .UnitIndex = 3,
+    .ValueValid = TRUE,
+    .Reg.Stride = 1,
+    .RegB.Stride = 1,
+};
+
+// Hold / burst capture
+uint8_t     Hold=FALSE;
+uint8_t     CaptureBuffer[CAPTURE_BYTES];
+uint16_t    CaptureLen;
+uint16_t    CaptureEdges;
+uint32_t    CaptureFirst;
+uint32_t    CapturePrev;
+int32_t     CapturePrevDelta;
+uint8_t     CaptureAnalysed;
+uint32_t    CaptureMinPeriod;
+uint32_t    CaptureMaxPeriod;
+uint32_t    CaptureMeanPeriod;
+uint16_t    CaptureMaxEdge;     // edge with the largest deviation
+volatile uint8_t Capturing=FALSE;
+uint16_t    CaptureStreamPos;
+
+// Binary stream
+uint8_t     TxBuf[TXBUF_SIZE];
+volatile uint8_t TxHead;
+volatile uint8_t TxTail;
+uint8_t     StreamEnabled=FALSE;
+uint16_t    StreamDropped;
+
+// Autorange / persistent state
+uint8_t     EeSlot;
+uint8_t     EeSeq;
+uint8_t     EeDirty=FALSE;          // set on every change
+uint8_t     EePending=FALSE;        // changed, not written yet
+uint32_t    EeTime;                 // latest change seen by persistService()
+
+// Front panel keys
+uint8_t     KeyIntegrator[KEYCNT];
+uint8_t     KeyDown;                // debounced state, one bit per key
+uint8_t     KeyHeld[KEYCNT];        // ticks since press, saturating
+uint8_t     KeyQueue[KEY_QUEUE];
+volatile uint8_t KeyHead;
+volatile uint8_t KeyTail;
+
+// Gate state shared by both capture channels
+volatile uint16_t StrideCount;
+volatile uint16_t StrideCountB;
+volatile uint32_t LastA;            // latest channel A capture
+volatile uint8_t  LastAValid;
+volatile uint32_t LastB;            // latest channel B timestamp
+volatile uint8_t  LastBValid;
+volatile uint8_t  GateOpen=FALSE;   // cleared by the capture at the gate end
+volatile uint32_t GateStart;        // first channel A edge of the gate
+volatile uint8_t  GateStarted;
+
+// Burst detection, per gate
+uint8_t     BurstMode=FALSE;
+uint8_t     BurstPreset;            // last preset chosen with Setup
+uint8_t     BurstSeen;
+uint32_t    BurstLast;              // previous edge
+uint32_t    BurstStart;             // first edge of the running burst
+uint32_t    BurstSegFirst;          // first and last edge in its sub-gate
+uint32_t    BurstSegLast;
+uint32_t    BurstSegN;
+uint8_t     BurstSkip;              // gate may have opened inside this burst
+
+#ifndef TESTING
+volatile uint32_t IRQ_Ticks;        // timer0, approximate centiseconds
+volatile uint16_t CaptureHigh;      // timer1 overflow extension
+volatile uint16_t IsrDone;          // TCNT1 as the last other handler returned
+
+// Character LCD, LcdWant is written by deData() and sets the cell's
+// LcdDirty flag, the refill clears the flag before it sends the cell
+volatile char    LcdWant[LCD_ROWS][LCD_COLS];
+volatile uint8_t LcdDirty[LCD_ROWS][LCD_COLS];
+volatile uint8_t LcdClean;          // clean cells seen in a row by the refill
+short       LcdRow = -1;            // -1 while the cursor is off the LCD
+short       LcdCol;
+uint8_t     LcdScan;                // next cell the refill looks at
+uint8_t     LcdAddress = 0xFF;      // DDRAM address counter, 0xFF unknown
+uint16_t    LcdQueue[LCD_QUEUE];
+volatile uint8_t LcdHead;
+volatile uint8_t LcdTail;
+uint16_t    LcdBusy = LCD_POWERUP;  // timer2 ticks until the next write
+#endif
+
 #ifdef TESTING
+int         StreamFd=-1;
+uint8_t     OutputMode=OUT_TUI;
+char        WrBuf[WRBUF_SIZE];
+int         WrLen;
+uint32_t    WrFlushTime;
+char       *StatePath;             // -S, no warm start state without it
+uint8_t     EeImage[EE_SIZE];
 uint64_t    InputSignal = -5;
+uint32_t    SimJitterPs = 500;    // rms edge jitter of the signal model
+uint64_t    InputSignalB = 10000;
+uint32_t    SimDelayBps = 1500000;  // channel B edges lag channel A
+uint64_t    SimTime;                // virtual time, timebase ticks
+uint64_t    SimGateDue;             // the running gate closes here
+uint8_t     SimReadingDue;          // its reading is published at the close
+uint64_t    SimNextEdge;            // edges before these were seen already
+uint32_t    SimBurstOn;             // channel A envelope, ticks, 0 = continuous
+uint32_t    SimBurstOff;
+uint64_t    SimNextEdgeB;
+uint64_t    SimLimit;               // stop at this virtual time, 0 = never
+uint8_t     SimClockMode=SIM_REALTIME;
+uint32_t    SimSpeed=1;
+struct timespec SimWall;            // wall clock at the last sync
+uint8_t     SimKeyPins;             // front panel keys down, as keyScan() reads them
+uint32_t    SimKeyUp[KEYCNT];       // release at this timer0 tick
+uint32_t    SimKeyTick;             // virtual timer0 ticks scanned so far
+
+// Ring file layout. The writer clears a record's Seq, fills it in and then
+// publishes Seq = index + 1 followed by Head, both with release stores.
+// A reader loads Head (acquire), copies record i % Capacity and accepts
+// the copy only if Seq reads i + 1 both before and after the copy;
+// otherwise the writer lapped it. Readers never write to the file.
+struct ringHeader
+{
+    char        Magic[8];
+    uint32_t    HeaderSize;
+    uint32_t    RecordSize;
+    uint64_t    Capacity;           // records
+    uint64_t    Head;               // records written so far
+    uint8_t     Reserved[32];
+};
+
+struct ringRecord
+{
+    uint64_t    Seq;                // index + 1, 0 while being written
+    uint8_t     Type;               // FRAME_READING, FRAME_CAPTURE, RING_EDGES
+    uint8_t     Len;
+    uint8_t     Reserved[6];
+    uint8_t     Payload[RING_PAYLOAD];
+};
+
+struct ringHeader *Ring;
+struct ringRecord *RingData;
+uint8_t     RingEdgesOn=FALSE;
+uint8_t     RingEdgeBuf[4 + 4 * RING_EDGE_MAX];
+uint8_t     RingEdgeCount;
+uint8_t     RingEdgeNewGate=TRUE;
+char       *JitterPath;             // analyse the edges of a ring file
+uint8_t     RenderBench=FALSE;
+uint8_t     StdinOpen=TRUE;         // cleared at end of file on stdin
+
+// Virtual terminal sink of the render harness, counts what a terminal
+// on stdout would receive
+struct renderCount
+{
+    uint64_t    Bytes;
+    uint64_t    Writes;             // write syscalls of the terminal writer
+    uint64_t    Moves;              // cursor positioning sequences
+    uint8_t     Esc;                // escape sequence parser state
+} Render;
+
+// Frame queue between the main loop and the terminal writer thread. The
+// main loop builds a frame in Slot[Head] and publishes it with a release
+// store of Head + 1, the writer hands Slot[Tail] to write(2) and frees it
+// with a release store of Tail + 1. A frame that finds the queue full is
+// dropped and the next one starts with a full repaint, which in turn makes
+// every older queued frame obsolete: the writer skips straight to it.
+struct termSlot
+{
+    uint32_t    Len;
+    uint8_t     Full;               // starts with a full repaint
+    char        Buf[TERM_FRAME];
+};
+
+struct term
+{
+    struct termSlot Slot[TERM_SLOTS];
+    uint32_t    Head;               // frames queued, main loop only
+    uint32_t    Tail;               // frames written, writer only
+    uint8_t     Drop;               // the frame being built is dropped
+    uint8_t     Repaint;            // the next frame repaints everything
+    uint8_t     Stop;
+    uint64_t    Frames;             // queued by the main loop
+    uint64_t    Dropped;            // dropped by the main loop
+    uint64_t    Skipped;            // queued but skipped by the writer
+    sem_t       Ready;              // one post per queued frame
+    pthread_t   Thread;
+    FILE       *Tty;                // the real stdout while the writer runs
+    ssize_t   (*Out)(int fd, const void *buf, size_t size);     // write(2)
+} Term;
+
+// Jitter results, all times in timebase ticks
+typedef double v4d __attribute__((vector_size(32)));
+typedef long long v4l __attribute__((vector_size(32)));
+
+struct jitter
+{
+    uint32_t    Periods;
+    double      MeanPeriod;
+    double      PeriodRms;          // period jitter
+    double      PeriodMin;
+    double      PeriodMax;
+    double      C2cRms;             // cycle to cycle
+    double      C2cMax;
+    double      TieRms;             // time interval error against the fit
+    double      TiePP;
+    double      SpurFreq;           // periodogram peak, cycles per edge
+    double      SpurAmp;            // its amplitude
+    uint32_t    Hist[JIT_BINS];
+    double      Psd[JIT_FREQS];     // amplitude per bin, k+1 / JIT_SEGMENT
+} Jitter;
+char       *StreamInPath;           // decode a firmware stream instead
 
 int         YTop;
 int         XTop;
@@ -151,19 +603,61 @@ void finalMeasurement(void);
 void setupDisplay(void);
 void getCounterValue(void);
 uint8_t getDividerSetting(uint64_t n);
+void regReset(struct regression *r);
+void regAddSample(struct regression *r, uint32_t ticks);
+uint64_t regFrequencyMilliHz(struct regression *r, uint32_t prescaler);
+uint64_t mulDiv64(uint64_t a, uint64_t b, uint64_t c);
+void calculateGateTime(void);
+void captureReset(void);
+uint8_t captureAddEdge(uint32_t ticks);
+uint32_t captureNextPeriod(uint16_t *pos, int32_t *delta);
+void captureAnalyse(void);
+void holdCapture(void);
+void streamInit(void);
+uint8_t streamFrame(uint8_t type, uint8_t *payload, uint8_t len);
+void streamReading(void);
+void streamCapture(void);
+void streamService(void);
+void persistLoad(void);
+void persistSave(void);
+void persistService(void);
+void persistFlush(void);
+void checkRange(void);
+void gateReset(void);
+void captureChannelA(uint32_t ticks);
+void captureChannelB(uint32_t ticks, uint8_t late);
+void captureBurst(uint32_t ticks);
+void burstClose(void);
+#ifdef BENCHMARK
+void benchmark(void);
+void benchPrint(const char *name, uint32_t cycles);
+ISR(TIMER0_COMPA_vect);
+ISR(TIMER2_COMPA_vect);
+#endif
+void updateNoiseEstimate(void);
 void calculateDisplayValue(void);
 void showValueOnDisplay(void);
+const char *getMode(void);
+const char *getUnits(void);
 void updateAppClock(void);
+uint32_t sysClock(void);
+void keyInit(void);
+void keyPut(char c);
+char keyGet(void);
+void keyScan(uint8_t pins);
 
 void layo_ShowValue(uint32_t value, short decimalPosition);
+short formatDecimal(char *str, uint32_t value, short decimalPosition);
 void layo_BackGround(void);
 
-void layo_bg_title(char *str);
+void layo_bg_title(const char *str);
+void layo_puts_P(const char *str);
 void layo_bgmodemenu(void);
 void layo_bg_inputs(void);
 void layo_bg_buttons_main(void);
-void layo_bg_units(char *str);
-void layo_bg_mode(char *str);
+void layo_bg_units(const char *str);
+void layo_bg_mode(const char *str);
+void layo_ShowCapture(void);
 
 void deSetCursorPosition(short row, short col);
 void deSetColor(int,int);
@@ -173,6 +667,26 @@ void deClearColor(void);
 #ifdef TESTING
 int  select(int, fd_set * __restrict, fd_set * __restrict, fd_set * __restrict, struct timeval * __restrict);
 void debug(void);
+void usage(char *prog);
+void parseOptions(int argc, char **argv);
+int  streamOpen(char *path);
+int  ringOpen(char *arg);
+void ringRecord(uint8_t type, uint8_t *payload, uint8_t len);
+void ringEdge(uint32_t ticks);
+void ringEdgeFlush(void);
+int  streamRecord(char *path);
+void jitterAnalyse(double *periods, const uint32_t *ends, uint32_t runs, struct jitter *j);
+void jitterCapture(void);
+int  jitterRing(char *path);
+int  renderBench(void);
+void layo_ShowJitter(void);
+void wrPrintf(const char *fmt, ...);
+void wrFlush(void);
+void stopHandler(int sig);
+void emitRecord(void);
+void termStart(void);
+void termFrame(void);
+void termStop(void);
 #endif
 
 // }}}
@@ -392,11 +906,16 @@ void set_conio_mode()
 // return 0 on no input on stdin
 // return <0 on error
 // return 1 on input available on stdin
+// once stdin is at end of file it only waits, so the loop does not spin
 int FHEkbhit()
 {
     struct timeval tv = { 0L, 1000L };  // 0L 0L means Do not wait.
+    if (SimClockMode == SIM_JUMP)
+        tv.tv_usec = 0;
     fd_set fds;
 
+    if (!StdinOpen)
+        return select(0, NULL, NULL, NULL, &tv);
     FD_ZERO(&fds);      // clear all file descriptors in the array
     FD_SET(0, &fds);    // add STDIN to the array of file descriptors
     // 1 is the number of file descriptors
@@ -408,6 +927,7 @@ int FHEkbhit()
 
 // }}}
 // {{{ short FHEgetchar() (blocking)
+// returns 0 at end of file and stops further polling of stdin
 
 short FHEgetchar() 
 {
@@ -415,6 +935,9 @@ short FHEgetchar()
     char c;
     if ((r = read(0, &c, sizeof(c))) < 0) {
         return r;
+    } else if (r == 0) {
+        StdinOpen = FALSE;
+        return 0;
     } else {
         return c;
     }
@@ -460,6 +983,575 @@ void FHEungetc(char c)
 // }}}
 */
 // }}}
+// {{{ Signal model
+
+// {{{ double simNoise(void)
+// approximately gaussian, unit variance (sum of 12 uniforms)
+
+double simNoise(void)
+{
+    static uint32_t seed = 12345;
+    double sum = 0;
+    for (int i=0; i<12; i++)
+    {
+        seed = seed * 1103515245L + 12345L;
+        sum += (seed >> 8) / 16777216.0;
+    }
+    return sum - 6.0;
+}
+
+// }}}
+// {{{ uint32_t simEdgeTicks(uint64_t n)
+// timebase counter value latched on the n-th prescaled input edge, the
+// input phase is locked to virtual time zero
+
+uint32_t simEdgeTicks(uint64_t n)
+{
+    double t;
+    t  = (double)n * Meas.PortPrescaler * TIMEBASE_FREQUENCY / InputSignal;
+    t += simNoise() * SimJitterPs * (TIMEBASE_FREQUENCY / 1e12);
+    return (uint32_t)(int64_t)floor(t);    // early edges jitter below zero
+}
+
+// }}}
+// {{{ uint32_t simEdgeTicksB(uint64_t n)
+// channel B is not prescaled, its edges lag channel A by SimDelayBps
+
+uint32_t simEdgeTicksB(uint64_t n)
+{
+    double t;
+    t  = SimDelayBps * (TIMEBASE_FREQUENCY / 1e12);
+    t += (double)n * TIMEBASE_FREQUENCY / InputSignalB;
+    t += simNoise() * SimJitterPs * (TIMEBASE_FREQUENCY / 1e12);
+    return (uint32_t)(int64_t)floor(t);    // early edges jitter below zero
+}
+
+// }}}
+// {{{ uint8_t simBurstActive(uint32_t ticks)
+// channel A carries signal at this timebase count, bursts start at zero
+
+uint8_t simBurstActive(uint32_t ticks)
+{
+    uint64_t t;
+    if (SimBurstOn == 0)
+        return TRUE;
+    t = SimTime + (uint32_t)(ticks - (uint32_t)SimTime);
+    return (t % ((uint64_t)SimBurstOn + SimBurstOff)) < SimBurstOn;
+}
+
+// }}}
+// {{{ uint64_t simFirstEdge(void)
+// first prescaled channel A edge at or after the current virtual time
+
+uint64_t simFirstEdge(void)
+{
+    uint64_t n = ceil((double)SimTime * InputSignal / ((double)Meas.PortPrescaler * TIMEBASE_FREQUENCY));
+    return (n > SimNextEdge) ? n : SimNextEdge;
+}
+
+// }}}
+// {{{ uint64_t simFirstEdgeB(void)
+
+uint64_t simFirstEdgeB(void)
+{
+    double t = (double)SimTime - SimDelayBps * (TIMEBASE_FREQUENCY / 1e12);
+    uint64_t n = (t > 0) ? (uint64_t)ceil(t * InputSignalB / TIMEBASE_FREQUENCY) : 0;
+    return (n > SimNextEdgeB) ? n : SimNextEdgeB;
+}
+
+// }}}
+
+// }}}
+// {{{ Virtual clock
+
+// {{{ void simClockSync(void)
+// advance the virtual time with the wall clock, a no-op in jump mode
+
+void simClockSync(void)
+{
+    struct timespec now;
+    uint64_t ns;
+    uint64_t ticks;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((SimWall.tv_sec == 0) || (SimClockMode == SIM_JUMP))
+        SimWall = now;
+    ns  = (uint64_t)(now.tv_sec - SimWall.tv_sec) * 1000000000ULL;
+    ns += now.tv_nsec - SimWall.tv_nsec;
+    // whole ticks only, the wall clock remainder carries over
+    ticks = ns * SimSpeed / (1000000000ULL / TIMEBASE_FREQUENCY);
+    SimTime += ticks;
+    ns = ticks * (1000000000ULL / TIMEBASE_FREQUENCY) / SimSpeed;
+    SimWall.tv_sec  += (SimWall.tv_nsec + ns) / 1000000000ULL;
+    SimWall.tv_nsec  = (SimWall.tv_nsec + ns) % 1000000000ULL;
+    if (SimLimit && (SimTime >= SimLimit))
+        ExitMainLoop = TRUE;
+}
+
+// }}}
+// {{{ void simClockGate(uint32_t closeTicks)
+// the signal model saw its last edge of the gate at timebase count
+// closeTicks, the next gate may not open before that
+
+void simClockGate(uint32_t closeTicks)
+{
+    SimGateDue = SimTime + (uint32_t)(closeTicks - (uint32_t)SimTime) + 1;
+}
+
+// }}}
+// {{{ uint8_t simGateReady(void)
+// gate scheduler, jump mode skips the idle time up to the gate close
+
+uint8_t simGateReady(void)
+{
+    if ((SimClockMode == SIM_JUMP) && (SimTime < SimGateDue))
+        SimTime = SimGateDue;
+    if (SimLimit && (SimTime >= SimLimit))
+        ExitMainLoop = TRUE;
+    return (SimTime >= SimGateDue) && !ExitMainLoop;
+}
+
+// }}}
+// {{{ uint8_t simPanelKey(short c)
+// press a front panel key from the terminal, FALSE when c is no panel key
+
+uint8_t simPanelKey(short c)
+{
+    static const char shortKeys[] = "123";
+    static const char holdKeys[]  = "!@#";
+    uint8_t k;
+
+    for (k=0; k<KEYCNT; k++)
+    {
+        if ((c == shortKeys[k]) || (c == holdKeys[k]))
+        {
+            SimKeyPins |= 1 << k;
+            SimKeyUp[k] = SimKeyTick + ((c == shortKeys[k]) ? SIM_KEY_SHORT : SIM_KEY_HOLD);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// }}}
+// {{{ void simKeyTicks(void)
+// the timer0 tick on the virtual clock, scans the panel keys every 10 ms
+// up to the current virtual time
+
+void simKeyTicks(void)
+{
+    uint32_t now = SimTime / (TIMEBASE_FREQUENCY / 100);
+    uint8_t  k;
+
+    for (; SimKeyTick < now; SimKeyTick++)
+    {
+        for (k=0; k<KEYCNT; k++)
+        {
+            if (SimKeyTick >= SimKeyUp[k])
+                SimKeyPins &= ~(1 << k);
+        }
+        keyScan(SimKeyPins);
+    }
+}
+
+// }}}
+
+// }}}
+
+// {{{ void usage(char *prog)
+
+void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s [-s file|pty] [-o csv|json] [-S statefile] [-B hz[,ns]] [-P on,off] [-b delay,width[,gap]]"
+                    " [-t real|jump|N] [-l seconds] [-r ring[:records] [-E] [-i stream]] [-j ring] [-R]\n", prog);
+    exit(1);
+}
+
+// }}}
+// {{{ void parseOptions(int argc, char **argv)
+
+void parseOptions(int argc, char **argv)
+{
+    struct stat st;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:o:S:B:t:l:r:Ei:j:RP:b:")) != -1)
+    {
+        switch (opt)
+        {
+            case 's' :  // binary stream to file, fifo or "pty"
+                if (!streamOpen(optarg))
+                {
+                    perror(optarg);
+                    exit(1);
+                }
+                break;
+            case 'o' :  // machine readable output
+                if (strcmp(optarg, "csv") == 0)
+                    OutputMode = OUT_CSV;
+                else if (strcmp(optarg, "json") == 0)
+                    OutputMode = OUT_JSON;
+                else
+                    usage(argv[0]);
+                signal(SIGINT, stopHandler);
+                signal(SIGTERM, stopHandler);
+                signal(SIGPIPE, stopHandler);
+                break;
+            case 'B' :  // channel B signal, Hz[,delay ns]
+                InputSignalB = strtoull(optarg, &optarg, 10);
+                if (*optarg == ',')
+                    SimDelayBps = strtoul(optarg + 1, NULL, 10) * 1000;
+                if (InputSignalB == 0)
+                    InputSignalB = 1;
+                break;
+            case 'P' :  // channel A bursts, on us,off us
+                SimBurstOn = strtoul(optarg, &optarg, 10) * (TIMEBASE_FREQUENCY / 1000000);
+                if (*optarg == ',')
+                    SimBurstOff = strtoul(optarg + 1, NULL, 10) * (TIMEBASE_FREQUENCY / 1000000);
+                break;
+            case 'b' :  // burst sub-gate, delay us,width us[,gap us]
+                Meas.BurstDelay = strtoul(optarg, &optarg, 10) * (TIMEBASE_FREQUENCY / 1000000);
+                if (*optarg == ',')
+                    Meas.BurstWidth = strtoul(optarg + 1, &optarg, 10) * (TIMEBASE_FREQUENCY / 1000000);
+                if (*optarg == ',')
+                    Meas.BurstGap = strtoul(optarg + 1, NULL, 10) * (TIMEBASE_FREQUENCY / 1000000);
+                break;
+            case 'S' :  // warm start state file
+                // a fifo or socket would block the main loop on open
+                if ((stat(optarg, &st) == 0) && !S_ISREG(st.st_mode) && !S_ISCHR(st.st_mode))
+                {
+                    fprintf(stderr, "%s: not a regular file or character device\n", optarg);
+                    exit(1);
+                }
+                StatePath = optarg;
+                break;
+            case 't' :  // virtual clock: real, jump or an acceleration factor
+                if (strcmp(optarg, "real") == 0)
+                    SimClockMode = SIM_REALTIME;
+                else if (strcmp(optarg, "jump") == 0)
+                    SimClockMode = SIM_JUMP;
+                else
+                {
+                    SimClockMode = SIM_FAST;
+                    SimSpeed = strtoul(optarg, NULL, 10);
+                    if (SimSpeed == 0)
+                        SimSpeed = 1;
+                }
+                break;
+            case 'r' :  // ring file recorder, path[:records]
+                if (!ringOpen(optarg))
+                {
+                    perror(optarg);
+                    exit(1);
+                }
+                break;
+            case 'E' :  // raw edge timestamps into the ring as well
+                RingEdgesOn = TRUE;
+                break;
+            case 'R' :  // render cost harness
+                RenderBench = TRUE;
+                break;
+            case 'j' :  // jitter report of the edges in a ring file
+                JitterPath = optarg;
+                break;
+            case 'i' :  // record a firmware stream, no simulation
+                StreamInPath = optarg;
+                break;
+            case 'l' :  // run length, virtual seconds
+                SimLimit = (uint64_t)(strtod(optarg, NULL) * TIMEBASE_FREQUENCY);
+                break;
+            default :
+                usage(argv[0]);
+        }
+    }
+}
+
+// }}}
+// {{{ Machine readable output
+
+// {{{ void stopHandler(int sig)
+// leave the main loop so outit() flushes buffered records
+
+void stopHandler(int sig)
+{
+    ExitMainLoop = TRUE;
+}
+
+// }}}
+// {{{ void wrPrintf(const char *fmt, ...)
+
+void wrPrintf(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (WrLen > WRBUF_SIZE - 512)
+        wrFlush();
+    va_start(ap, fmt);
+    WrLen += vsnprintf(WrBuf + WrLen, WRBUF_SIZE - WrLen, fmt, ap);
+    va_end(ap);
+    // keep a live pipe moving at least once a second
+    if ((OurTime - WrFlushTime) >= 100)
+        wrFlush();
+}
+
+// }}}
+// {{{ void wrFlush(void)
+
+void wrFlush(void)
+{
+    int     done = 0;
+    ssize_t n;
+
+    while (done < WrLen)
+    {
+        n = write(1, WrBuf + done, WrLen - done);
+        if (n <= 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        done += n;
+    }
+    WrLen = 0;
+    WrFlushTime = OurTime;
+}
+
+// }}}
+// {{{ void emitRecord(void)
+// one record per reading, the first call writes the csv header
+
+void emitRecord(void)
+{
+    static const char *modeKey[]  = { "freq", "period", "pulsehi", "pulselo", "event",
+                                      "ratio", "interval", "burst" };
+    static const char *inputKey[] = { "mhz", "ghz", "digital", "mhz" };
+    static uint8_t    header = TRUE;
+    const char *mode  = modeKey[(CommandRegister & MASK_MODE) >> 2];
+    const char *input = inputKey[(CommandRegister & MASK_INPUT) >> 5];
+    char  value[14];
+    char  unit[8];
+    uint32_t samples;
+    short i;
+
+    if (OutputMode == OUT_TUI)
+        return;
+    if (header)
+    {
+        header = FALSE;
+        if (OutputMode == OUT_CSV)
+            wrPrintf("time,mode,input,divider,samples,ticks,value,unit\n");
+        return;
+    }
+    if (Meas.ValueValid)
+        formatDecimal(value, Meas.DisplayValue, Meas.DecimalPosition);
+    else
+        strcpy(value, (OutputMode == OUT_CSV) ? "" : "null");
+    strncpy_P(unit, getUnits(), sizeof(unit) - 1);
+    unit[sizeof(unit) - 1] = 0;
+    for (i=strlen(unit); (i > 0) && (unit[i-1] == ' '); i--)
+        unit[i-1] = 0;
+    samples = BurstMode ? Meas.BurstEdges : Meas.Reg.N;
+
+    if (OutputMode == OUT_CSV)
+        wrPrintf("%lu.%02lu,%s,%s,%lu,%lu,%lu,%s,%s\n",
+            (unsigned long)OurTime / 100, (unsigned long)OurTime % 100, mode, input,
+            (unsigned long)Meas.PortPrescaler, (unsigned long)samples, (unsigned long)Meas.TimeBasePulsFinal, value, unit);
+    else
+        wrPrintf("{\"time\":%lu.%02lu,\"mode\":\"%s\",\"input\":\"%s\",\"divider\":%lu,"
+            "\"samples\":%lu,\"ticks\":%lu,\"value\":%s,\"unit\":\"%s\"}\n",
+            (unsigned long)OurTime / 100, (unsigned long)OurTime % 100, mode, input,
+            (unsigned long)Meas.PortPrescaler, (unsigned long)samples, (unsigned long)Meas.TimeBasePulsFinal, value, unit);
+}
+
+// }}}
+
+// }}}
+
+// {{{ Terminal writer
+// In TUI mode stdout is a memory stream that fills the current frame, one
+// frame per mainLoop() plus debug() pass. Frames are written to the real
+// terminal by termWriter(); the main loop never waits for it.
+
+// {{{ ssize_t termWrite(void *cookie, const char *buf, size_t size)
+
+ssize_t termWrite(void *cookie, const char *buf, size_t size)
+{
+    struct termSlot *s = &Term.Slot[Term.Head % TERM_SLOTS];
+
+    // a dropped frame may share its slot with the one being written
+    if (!Term.Drop && (s->Len + size <= TERM_FRAME))
+    {
+        memcpy(s->Buf + s->Len, buf, size);
+        s->Len += size;
+    }
+    else
+        Term.Drop = TRUE;
+    return size;
+}
+
+// }}}
+// {{{ void *termWriter(void *arg)
+
+void *termWriter(void *arg)
+{
+    uint32_t head, tail = 0;
+    struct termSlot *s;
+    uint32_t done;
+    ssize_t  n;
+
+    for (;;)
+    {
+        sem_wait(&Term.Ready);
+        head = __atomic_load_n(&Term.Head, __ATOMIC_ACQUIRE);
+        if (tail == head)
+        {
+            if (__atomic_load_n(&Term.Stop, __ATOMIC_ACQUIRE))
+                break;
+            continue;
+        }
+        // latest wins, a full repaint makes the frames before it obsolete
+        for (uint32_t i=head-1; i != tail; i--)
+            if (Term.Slot[i % TERM_SLOTS].Full)
+            {
+                Term.Skipped += i - tail;
+                tail = i;
+                break;
+            }
+        s = &Term.Slot[tail % TERM_SLOTS];
+        for (done=0; done < s->Len; done += n)
+        {
+            n = Term.Out(1, s->Buf + done, s->Len - done);
+            if (n <= 0)
+            {
+                if ((n < 0) && (errno == EINTR))
+                {
+                    n = 0;
+                    continue;
+                }
+                break;
+            }
+        }
+        __atomic_store_n(&Term.Tail, ++tail, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+// }}}
+// {{{ void termRepaint(void)
+// everything but the debug lines, which every frame draws anyway; the
+// value is only redrawn after a gate and stays frozen in hold
+
+void termRepaint(void)
+{
+    deClearScreen();
+    layo_BackGround();
+    showValueOnDisplay();
+}
+
+// }}}
+// {{{ void termBegin(void)
+
+void termBegin(void)
+{
+    struct termSlot *s = &Term.Slot[Term.Head % TERM_SLOTS];
+
+    Term.Drop = (Term.Head - __atomic_load_n(&Term.Tail, __ATOMIC_ACQUIRE)) >= TERM_SLOTS;
+    if (Term.Drop)
+        return;
+    s->Len = 0;
+    s->Full = Term.Repaint;
+    if (Term.Repaint)
+    {
+        Term.Repaint = FALSE;
+        termRepaint();
+    }
+}
+
+// }}}
+// {{{ void termFrame(void)
+// queue the frame built since termBegin() and start the next one
+
+void termFrame(void)
+{
+    if (!Term.Tty)
+        return;
+    fflush(stdout);
+    if (Term.Drop)
+    {
+        Term.Dropped++;
+        Term.Repaint = TRUE;
+    }
+    else if (Term.Slot[Term.Head % TERM_SLOTS].Len)
+    {
+        Term.Frames++;
+        __atomic_store_n(&Term.Head, Term.Head + 1, __ATOMIC_RELEASE);
+        sem_post(&Term.Ready);
+    }
+    termBegin();
+}
+
+// }}}
+// {{{ void termStart(void)
+// TUI only, without a thread everything stays on the real stdout
+
+void termStart(void)
+{
+    cookie_io_functions_t io = { NULL, termWrite, NULL, NULL };
+    FILE *f;
+
+    if (OutputMode != OUT_TUI)
+        return;
+    fflush(stdout);
+    if ((f = fopencookie(NULL, "w", io)) == NULL)
+        return;
+    if (!Term.Out)
+        Term.Out = write;
+    sem_init(&Term.Ready, 0, 0);
+    if (pthread_create(&Term.Thread, NULL, termWriter, NULL) != 0)
+    {
+        fclose(f);
+        return;
+    }
+    setvbuf(f, NULL, _IOFBF, BUFSIZ);
+    Term.Tty = stdout;
+    stdout = f;
+    termBegin();
+}
+
+// }}}
+// {{{ void termStop(void)
+// drain the queue and go back to the real stdout, a frame dropped at the
+// end is made up for by a direct repaint
+
+void termStop(void)
+{
+    FILE *f = stdout;
+
+    if (!Term.Tty)
+        return;
+    termFrame();
+    __atomic_store_n(&Term.Stop, TRUE, __ATOMIC_RELEASE);
+    sem_post(&Term.Ready);
+    pthread_join(Term.Thread, NULL);
+    stdout = Term.Tty;
+    Term.Tty = NULL;
+    fclose(f);
+    sem_destroy(&Term.Ready);
+    if (Term.Repaint)
+    {
+        termRepaint();
+        debug();
+    }
+}
+
+// }}}
+
+// }}}
+
+// }}}
+#endif
+
+// {{{ Command input
 
 // {{{ void setCommandRegister(uint8_T value, uint8_t mask)
 
@@ -504,6 +1596,18 @@ void parseCommand(char c)
             setCommandRegister(MASK_MODE, EVENT);
             break;
 
+        case cRATIO     : // frequency ratio A/B
+            setCommandRegister(MASK_MODE, RATIO);
+            break;
+
+        case cINTERVAL  : // time interval A->B
+            setCommandRegister(MASK_MODE, INTERVAL);
+            break;
+
+        case cBURST     : // gated burst frequency
+            setCommandRegister(MASK_MODE, BURST);
+            break;
+
             // Input
         case iMHz       : // MHz
             setCommandRegister(MASK_INPUT, MHZ);
@@ -520,19 +1624,50 @@ void parseCommand(char c)
             // Precision 
         case iP6DIGITS  : // 6 digits precision
             setCommandRegister(MASK_DIGITS, P6DIGITS);
-            DisplayValue = 145750;
             break;
 
         case iP7DIGITS  : // 7 digits precision
             setCommandRegister(MASK_DIGITS, P7DIGITS);
-            DisplayValue = 1457500;
+            break;
+
+            // Front panel
+        case kMODE      : // next mode, wraps after burst
+            setCommandRegister(MASK_MODE, ((CommandRegister & MASK_MODE) == BURST) ? FREQUENCY : (CommandRegister & MASK_MODE) + PERIOD);
+            break;
+
+        case kINPUT     : // next input
+            setCommandRegister(MASK_INPUT, ((CommandRegister & MASK_INPUT) == DIGITAL) ? MHZ : (CommandRegister & MASK_INPUT) + GHZ);
+            break;
+
+        case kDIGITS    : // 6 <-> 7 digits
+            setCommandRegister(MASK_DIGITS, (CommandRegister & MASK_DIGITS) ^ MASK_DIGITS);
+            break;
+
+        case kRESTART   : // restart the capture, hold stays on
+            if (Hold)
+            {
+                captureReset();
+                Capturing = TRUE;
+            }
             break;
 
             // Buttons
-        case bSETUP     : // Setup
+        case bSETUP     : // Setup, in burst mode the next sub-gate preset
+            if ((CommandRegister & MASK_MODE) == BURST)
+            {
+                BurstPreset = (BurstPreset + 1) % BURST_PRESETS;
+                Meas.BurstDelay = pgm_read_word(&BurstPresets[BurstPreset][0]) * (TIMEBASE_FREQUENCY / 1000000);
+                Meas.BurstWidth = pgm_read_word(&BurstPresets[BurstPreset][1]) * (TIMEBASE_FREQUENCY / 1000000);
+                CommandRegisterChanged = TRUE;      // new gate, redraw
+            }
             break;
 
         case bHOLD      : // Hold
+            Hold = !Hold;
+            if (Hold)
+                captureReset();
+            Capturing = Hold;
+            setupDisplay();
             break;
 
 #ifdef TESTING
@@ -546,304 +1681,2652 @@ void parseCommand(char c)
 }
 
 // }}}
+// {{{ Key scanning
+// Setup, 6/7 digits and hold/Cont, active low on PB1..PB3 with pull-ups.
+// keyScan() runs in the timer0 interrupt, parseCommand() reads the
+// resulting commands through keyGet() from the main loop.
 
-// }}}
-#endif
-
-// {{{ Initialisation Code
+const uint8_t KeyTable[KEYCNT][4] PROGMEM = {
+    // flags                        press     long/repeat
+    { KEY_F_LONG | KEY_F_REPEAT,    kMODE,    bSETUP   },  // Setup: next mode, long: setup, repeats
+    { KEY_F_LONG,                   kDIGITS,  kINPUT   },  // 6/7 digits, long: next input
+    { KEY_F_LONG,                   bHOLD,    kRESTART },  // hold/Cont, long: restart
+};
 
-// {{{ void init(void)
+// {{{ void keyInit(void)
+
+void keyInit(void)
+{
+#ifndef TESTING
+    DDRB &= ~(_BV(PB1) | _BV(PB2) | _BV(PB3));
+    PORTB |= _BV(PB1) | _BV(PB2) | _BV(PB3);
+#endif
+}
+
+// }}}
+// {{{ void keyPut(char c)
+// single producer, drops when the main loop falls behind
+
+void keyPut(char c)
+{
+    uint8_t next = (KeyHead + 1) % KEY_QUEUE;
+    if (next == KeyTail)
+        return;
+    KeyQueue[KeyHead] = c;
+    KeyHead = next;
+}
+
+// }}}
+// {{{ char keyGet(void)
+// next command or 0
+
+char keyGet(void)
+{
+    char c;
+    if (KeyHead == KeyTail)
+        return 0;
+    c = KeyQueue[KeyTail];
+    KeyTail = (KeyTail + 1) % KEY_QUEUE;
+    return c;
+}
+
+// }}}
+// {{{ void keyScan(uint8_t pins)
+// one tick of the debounce and event logic, bit k of pins set = key k down
+
+void keyScan(uint8_t pins)
+{
+    uint8_t k;
+    uint8_t bit;
+    uint8_t flags;
+
+    for (k=0; k<KEYCNT; k++)
+    {
+        bit = 1 << k;
+        if (pins & bit)
+        {
+            if (KeyIntegrator[k] < KEY_INTEGRATE)
+                KeyIntegrator[k]++;
+        }
+        else if (KeyIntegrator[k] > 0)
+            KeyIntegrator[k]--;
+
+        flags = pgm_read_byte(&KeyTable[k][0]);
+        if (!(KeyDown & bit))
+        {
+            if (KeyIntegrator[k] < KEY_INTEGRATE)
+                continue;
+            KeyDown |= bit;
+            KeyHeld[k] = 0;
+            if (!(flags & KEY_F_LONG))
+                keyPut(pgm_read_byte(&KeyTable[k][1]));
+            continue;
+        }
+        if (KeyIntegrator[k] == 0)
+        {
+            // released, a short press of a long press key reports here
+            KeyDown &= ~bit;
+            if ((flags & KEY_F_LONG) && (KeyHeld[k] < KEY_LONG))
+                keyPut(pgm_read_byte(&KeyTable[k][1]));
+            continue;
+        }
+        if (KeyHeld[k] < 0xFF)
+            KeyHeld[k]++;
+        if ((flags & KEY_F_LONG) && (KeyHeld[k] == KEY_LONG))
+            keyPut(pgm_read_byte(&KeyTable[k][2]));
+        if ((flags & KEY_F_REPEAT) && (KeyHeld[k] >= KEY_LONG + KEY_REPEAT_DELAY) &&
+            ((KeyHeld[k] - KEY_LONG - KEY_REPEAT_DELAY) % KEY_REPEAT == 0))
+        {
+            keyPut(pgm_read_byte(&KeyTable[k][2]));
+            if (KeyHeld[k] >= KEY_LONG + KEY_REPEAT_DELAY + KEY_REPEAT)
+                KeyHeld[k] -= KEY_REPEAT;   // keep repeating past 255
+        }
+    }
+}
+
+// }}}
+
+// }}}
+
+// }}}
+
+#ifndef TESTING
+// {{{ Display driver
+// HD44780 backend. The layout writes into the LcdWant shadow only, the
+// timer2 interrupt drains LcdQueue into the controller one entry per tick
+// and refills it from the dirty cells, looking at one cell per tick. Nothing
+// here waits on the controller or loops over the shadow, so the capture
+// interrupts are held off for one short handler at most.
+
+// {{{ void lcdPut(uint16_t entry)
+// queue a command, data byte or init nibble, drops when full
+
+void lcdPut(uint16_t entry)
+{
+    uint8_t next = (LcdHead + 1) % LCD_QUEUE;
+    if (next == LcdTail)
+        return;
+    LcdQueue[LcdHead] = entry;
+    LcdHead = next;
+}
+
+// }}}
+// {{{ void lcdWrite(uint8_t nibble, uint8_t rs)
+
+void lcdWrite(uint8_t nibble, uint8_t rs)
+{
+    PORTC = (PORTC & 0xC0) | (rs ? _BV(PC4) : 0) | (nibble & 0x0F);
+    PORTC |= _BV(PC5);
+    __asm__ volatile ("nop\n\tnop\n\tnop\n\tnop\n\tnop\n\tnop\n\tnop\n\tnop");  // E high >= 450 ns
+    PORTC &= ~_BV(PC5);
+}
+
+// }}}
+// {{{ void lcdRefill(void)
+// look at the next cell and queue it when dirty, with an address command
+// when the DDRAM address counter is not already there
+
+void lcdRefill(void)
+{
+    uint8_t row = LcdScan / LCD_COLS;
+    uint8_t col = LcdScan % LCD_COLS;
+    uint8_t address;
+
+    if (++LcdScan >= LCD_ROWS*LCD_COLS)
+        LcdScan = 0;
+    if (!LcdDirty[row][col])
+    {
+        // a whole round without work, idle until deData()
+        if (++LcdClean >= LCD_ROWS*LCD_COLS)
+            TIMSK2 = 0;
+        return;
+    }
+    LcdDirty[row][col] = FALSE;
+    LcdClean = 0;
+    address = row * 0x40 + col;
+    if (address != LcdAddress)
+        lcdPut(0x80 | address);     // set DDRAM address
+    lcdPut(LCD_RS | (uint8_t)LcdWant[row][col]);
+    LcdAddress = address + 1;
+}
+
+// }}}
+// {{{ void lcdService(void)
+// timer2 interrupt body, one queue entry per tick
+
+void lcdService(void)
+{
+    uint16_t entry;
+
+    if (LcdBusy)
+    {
+        LcdBusy--;
+        return;
+    }
+    if (LcdHead == LcdTail)
+        lcdRefill();
+    if (LcdHead == LcdTail)
+        return;
+    entry = LcdQueue[LcdTail];
+    LcdTail = (LcdTail + 1) % LCD_QUEUE;
+
+    if (entry & LCD_NIBBLE)
+    {
+        lcdWrite(entry, 0);
+        LcdBusy = LCD_INIT_WAIT;
+        return;
+    }
+    lcdWrite(entry >> 4, (entry & LCD_RS) != 0);
+    lcdWrite(entry, (entry & LCD_RS) != 0);
+    if (!(entry & LCD_RS) && ((entry & 0xFC) == 0))
+        LcdBusy = LCD_CLEAR_WAIT;      // clear display, return home
+}
+
+// }}}
+// {{{ void lcdInit(void)
+
+void lcdInit(void)
+{
+    DDRC |= 0x3F;
+    PORTC &= 0xC0;
+    for (uint8_t i=0; i<LCD_ROWS*LCD_COLS; i++)
+    {
+        LcdWant[i / LCD_COLS][i % LCD_COLS] = ' ';
+        LcdDirty[i / LCD_COLS][i % LCD_COLS] = FALSE;
+    }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        // reset by instruction into 4 bit mode
+        lcdPut(LCD_NIBBLE | 0x03);
+        lcdPut(LCD_NIBBLE | 0x03);
+        lcdPut(LCD_NIBBLE | 0x03);
+        lcdPut(LCD_NIBBLE | 0x02);
+        lcdPut(0x28);       // 4 bit, 2 lines, 5x8
+        lcdPut(0x08);       // display off
+        lcdPut(0x01);       // clear, matches the blank LcdWant
+        lcdPut(0x06);       // increment, no shift
+        lcdPut(0x0C);       // display on, cursor off
+    }
+    LcdAddress = 0;
+    // timer2 CTC at LCD_TICK_US
+    TCCR2A = _BV(WGM21);
+    TCCR2B = _BV(CS21);
+    OCR2A = (F_CPU / 8) * LCD_TICK_US / 1000000UL - 1;
+    TIMSK2 = _BV(OCIE2A);
+}
+
+// }}}
+
+void deSetCursorPosition(short row, short col)
+{
+    if (row == LCD_LINE0)
+        LcdRow = 0;
+    else if (row == LCD_LINE1)
+        LcdRow = 1;
+    else
+        LcdRow = -1;
+    LcdCol = col - LCD_COL0;
+}
+
+void deData(char c)
+{
+    if ((LcdRow >= 0) && (LcdCol >= 0) && (LcdCol < LCD_COLS) &&
+        (LcdWant[LcdRow][LcdCol] != c))
+    {
+        // the cell before its flag, the refill clears the flag first
+        LcdWant[LcdRow][LcdCol] = c;
+        LcdDirty[LcdRow][LcdCol] = TRUE;
+        LcdClean = 0;
+        TIMSK2 = _BV(OCIE2A);
+    }
+    LcdCol++;
+}
+
+void deClearScreen(void)
+{
+    for (uint8_t i=0; i<LCD_ROWS*LCD_COLS; i++)
+        if (LcdWant[i / LCD_COLS][i % LCD_COLS] != ' ')
+        {
+            LcdWant[i / LCD_COLS][i % LCD_COLS] = ' ';
+            LcdDirty[i / LCD_COLS][i % LCD_COLS] = TRUE;
+        }
+    LcdClean = 0;
+    TIMSK2 = _BV(OCIE2A);
+}
+
+void deSetColor(int fg, int bg)
+{
+}
+
+void deClearColor(void)
+{
+}
+
+int dePutc(char c, FILE *f)
+{
+    deData(c);
+    return 0;
+}
+
+FILE DisplayOut = FDEV_SETUP_STREAM(dePutc, NULL, _FDEV_SETUP_WRITE);
+
+// }}}
+#endif
+
+// {{{ Initialisation Code
+
+// {{{ void init(void)
 
 void init(void)
 {
-#ifdef TESTING
-    set_conio_mode();
-#endif
+#ifdef TESTING
+    if (isatty(0))
+        set_conio_mode();
+    termStart();
+#endif
+    persistLoad();
+
+    initDisplay();
+    initMultiplexers();
+    keyInit();
+    initMenu();
+    initMeasuring();
+    streamInit();
+}
+
+// }}}
+// {{{  void outit(void)
+
+void outit(void)
+{
+    persistFlush();
+#ifdef TESTING
+    if (OutputMode != OUT_TUI)
+    {
+        wrFlush();
+        return;
+    }
+    termStop();
+    deSetCursorPosition(33,1); 
+    printf("\r\nReciproke Counter Finished\r\n");
+    printf("%llu terminal frames, %llu dropped, %llu skipped\r\n", (unsigned long long)Term.Frames,
+           (unsigned long long)Term.Dropped, (unsigned long long)Term.Skipped);
+#endif
+}
+
+// }}}
+
+void initMultiplexers(void)
+{/*{{{*/
+#ifndef TESTING
+    // channel B on INT0 (PD2), rising edge, enabled in the dual modes
+    DDRD &= ~_BV(PD2);
+    EICRA = _BV(ISC01) | _BV(ISC00);
+    EIMSK = 0;
+#endif
+}/*}}}*/
+
+void initDisplay(void)
+{/*{{{*/
+#ifdef TESTING
+    if (OutputMode != OUT_TUI)
+    {
+        emitRecord();   // header
+        return;
+    }
+#else
+    stdout = &DisplayOut;   // layo_printf() goes to the display
+    lcdInit();
+#endif
+    deClearScreen();
+    layo_BackGround();
+}/*}}}*/
+
+void initMenu(void)
+{/*{{{*/
+#ifdef TESTING
+    if (OutputMode != OUT_TUI)
+        return;
+#endif
+    layo_bgmodemenu();
+    layo_bg_inputs();
+    layo_bg_buttons_main();
+}/*}}}*/
+
+void initMeasuring(void)
+{/*{{{*/
+#ifndef TESTING
+    // timer0 ticks at F_CPU/1024/(OCR0A+1), about 100 Hz
+    TCCR0A = _BV(WGM01);
+    TCCR0B = _BV(CS02) | _BV(CS00);
+    OCR0A = (F_CPU / 1024 / 100) - 1;
+    TIMSK0 = _BV(OCIE0A);
+    // timer1 counts the CPU clock, which is the 10 MHz timebase: T1 as an
+    // external clock only goes up to F_CPU/2.5. Capture on rising ICP1.
+    TCCR1A = 0;
+    TCCR1B = _BV(ICNC1) | _BV(ICES1) | _BV(CS10);
+    TIMSK1 = _BV(ICIE1) | _BV(TOIE1);
+    sei();
+#endif
+}/*}}}*/
+
+// }}}
+// {{{ int main(void)
+
+int main(int argc, char **argv)
+{
+#ifdef TESTING
+    parseOptions(argc, argv);
+    if (StreamInPath)
+        return streamRecord(StreamInPath);
+    if (JitterPath)
+        return jitterRing(JitterPath);
+    if (RenderBench)
+        return renderBench();
+#endif
+#ifdef BENCHMARK
+    benchmark();
+#endif
+    init();
+    while (!ExitMainLoop)
+    {
+        mainLoop();
+#ifdef TESTING
+        debug();
+        termFrame();
+#endif
+    }
+    outit();
+}
+
+// }}}
+// {{{ void mainLoop(void)
+// {{ MainLoop code
+
+void mainLoop(void)
+{
+    char c;
+#ifdef TESTING
+    short k;
+    // the terminal stands in for the front panel
+    if ((FHEkbhit() > 0) && ((k = FHEgetchar()) > 0) && !simPanelKey(k))
+        keyPut(k);
+    //printf("a\n");
+#endif
+    while ((c = keyGet()) != 0)
+        parseCommand(c);
+    updateAppClock();
+    streamService();
+    persistService();
+
+    //printf("b\n");
+    if (CommandRegisterChanged)
+    {
+        CommandRegisterChanged = FALSE;
+#ifdef TESTING
+        SimReadingDue = FALSE;      // measured in the old mode
+#endif
+        setupCommandExecution();
+        //printf("c\n");
+        setupDisplay();
+        //printf("d\n");
+    }
+    if (Hold)
+    {
+        holdCapture();
+        return;
+    }
+#ifdef TESTING
+    // the signal model runs a whole gate at once, its reading waits for
+    // the gate close on the virtual clock and the next gate opens then
+    if (SimReadingDue && simGateReady())
+    {
+        SimReadingDue = FALSE;
+        updateAppClock();
+        showValueOnDisplay();
+        streamReading();
+        emitRecord();
+    }
+    if (!SimReadingDue && simGateReady())
+    {
+        InputSignal = 48000L;
+#endif
+        if (!Meas.RangeValid)
+            sampleMeasurement();
+        finalMeasurement();
+        checkRange();
+        getCounterValue();
+        calculateDisplayValue();
+#ifdef TESTING
+        SimReadingDue = TRUE;
+    }
+#else
+        showValueOnDisplay();
+        streamReading();
+#endif
+}
+
+// }}
+// }}}
+
+// {{{ void setupCommandExecution(void)
+
+void setupCommandExecution(void)
+{
+    static uint8_t prevCommandRegister = 0xFF;
+    uint16_t mode;
+
+    mode = CommandRegister & MASK_MODE;
+    switch (mode)
+    {
+        case cFREQUENCY :
+
+            break;
+
+        case cPERIOD    :
+
+            break;
+
+        case cPULSEHI   :
+
+            break;
+
+        case cPULSELO   :
+
+            break;
+
+        case cEVENT     :
+
+            break;
+
+        case iGHZ       : 
+
+            break;
+
+        case iMHz       : 
+
+            break;
+
+        case iDIGITAL   : 
+
+            break;
+
+        case iP6DIGITS  :
+            if ((CommandRegister & MASK_DIGITS) == FALSE)
+                break;
+
+        case iP7DIGITS  :
+            if ((CommandRegister & MASK_DIGITS) == TRUE)
+                break;
+    }
+    Meas.Precision = (CommandRegister & MASK_DIGITS) ? 7 : 6;
+    if ((prevCommandRegister != 0xFF) &&
+        ((CommandRegister & MASK_INPUT) != (prevCommandRegister & MASK_INPUT)))
+        Meas.RangeValid = FALSE;
+    BurstMode = ((CommandRegister & MASK_MODE) == BURST);
+    Meas.BurstRate = 0;     // unknown until the first burst gate
+    prevCommandRegister = CommandRegister;
+    EeDirty = TRUE;
+    Meas.NoiseTicks = 4*NOISE_FLOOR;     // unknown signal, start pessimistic
+    Meas.PrevFrequencyMilliHz = 0;
+    CommandRegisterChanged = FALSE;
+}
+
+// }}}            
+// {{{ void setupDisplay(void)
+
+void setupDisplay(void)
+{
+#ifdef TESTING
+    if (OutputMode != OUT_TUI)
+        return;
+#endif
+    layo_BackGround();
+}
+
+// }}}
+
+// {{{ void sampleMeasurement(void);
+
+void sampleMeasurement(void)
+{
+    Meas.PortPrescaler = 2; // (for the first sample measurement
+#ifdef TESTING
+    {
+        // GateFreq = InputSignal / PortPrescaler; 
+        // GateTime = GatePeriod / 2
+        // GateTime = 1 / (GateFreq * 2)
+        // CounterValue = TIMEBASE_FREQUENCY * GateTime
+        // CounterValue = TIMEBASE_FREQUENCY / (GateFreq * 2)
+        // CounterValue = TIMEBASE_FREQUENCY / ((InputSignal/PortPrescaler) * 2)
+        Meas.CounterValue = (TIMEBASE_FREQUENCY * Meas.PortPrescaler) / (InputSignal * 2);
+        Meas.TimeBasePulsTest = Meas.CounterValue;
+        Meas.TimeBasePulsTestB = TIMEBASE_FREQUENCY / InputSignalB;
+    }
+#else
+    {
+        // short ranging gate on every edge of the input divided by 2
+        uint32_t start = sysClock();
+        Meas.DividerSetting = 1;
+        Meas.Reg.Stride = 1;
+        Meas.RegB.Stride = 1;
+        Meas.GateTimeFinal = GATE_MIN_TICKS;
+        gateReset();
+        GateOpen = TRUE;
+        while (GateOpen && ((sysClock() - start) < 4))
+            ;
+        GateOpen = FALSE;
+        burstClose();
+        // edges come every PortPrescaler input periods, keep one period as
+        // checkRange() and the simulator do; in burst mode only the spacing
+        // inside the bursts counts
+        if (BurstMode && (Meas.BurstEdges > 1))
+            Meas.TimeBasePulsTest = Meas.BurstTicks / Meas.BurstEdges / Meas.PortPrescaler;
+        else
+            Meas.TimeBasePulsTest = (Meas.Reg.N > 1) ? Meas.Reg.TLast / (Meas.Reg.N - 1) / Meas.PortPrescaler : 0;
+        Meas.TimeBasePulsTestB = (Meas.RegB.N > 1) ? Meas.RegB.TLast / (Meas.RegB.N - 1) : 0;
+        Meas.CounterValue = Meas.TimeBasePulsTest;
+    }
+#endif
+    Meas.DividerSetting = getDividerSetting(Meas.TimeBasePulsTest);
+    Meas.RangeValid = TRUE;
+    EeDirty = TRUE;
+}
+
+// }}}
+// {{{ void finalMeasurement(void);
+
+void finalMeasurement(void)
+{
+    Meas.PortPrescaler = 1UL << Meas.DividerSetting;
+    calculateGateTime();
+    gateReset();
+#ifdef TESTING
+    {
+        // both channels in time order, as the two capture interrupts see them
+        uint8_t  dual = DUALMODE(CommandRegister);
+        uint64_t n = simFirstEdge();
+        uint64_t m = simFirstEdgeB();
+        uint32_t t = simEdgeTicks(n);
+        uint32_t tb = simEdgeTicksB(m);
+        uint32_t start = t;
+        uint32_t last = t;
+        while (((t - start) < Meas.GateTimeFinal) && (Meas.Reg.N < REG_MAX_SAMPLES))
+        {
+            if (dual && !Meas.BTooFast && ((int32_t)(tb - t) < 0))
+            {
+                captureChannelB(tb, FALSE);
+                tb = simEdgeTicksB(++m);
+                continue;
+            }
+            if (simBurstActive(t))
+            {
+                captureChannelA(t);
+                ringEdge(t);
+            }
+            last = t;
+            t = simEdgeTicks(++n);
+        }
+        ringEdgeFlush();
+        SimNextEdge = n;
+        SimNextEdgeB = m;
+        simClockGate(last);
+    }
+#elif defined(BENCHMARK)
+    // what the capture interrupt does during one gate
+    for (uint16_t n=0; n<BENCH_SAMPLES; n++)
+        regAddSample(&Meas.Reg, BENCH_PERIOD * n + (n * 7) % 3);
+#else
+    {
+        // the capture closes the gate on the timestamps, the clock only
+        // ends a gate whose input went away: the first edge comes at most
+        // one spacing late and the gate holds at least eight of them
+        uint32_t start = sysClock();
+        uint32_t limit = 2 * (Meas.GateTimeFinal / (TIMEBASE_FREQUENCY / 100)) + 2;
+        GateOpen = TRUE;
+        while (GateOpen && ((sysClock() - start) < limit))
+            ;
+        GateOpen = FALSE;
+    }
+#endif
+    burstClose();
+    Meas.TimeBasePulsFinal = BurstMode ? Meas.BurstTicks : Meas.Reg.TLast;
+    if (BurstMode && Meas.BurstSpans)
+    {
+        Meas.BurstRate = (float)Meas.BurstSpans / Meas.GateTimeFinal;
+        Meas.BurstDuty = (float)Meas.BurstTicks / Meas.GateTimeFinal;
+    }
+}
+
+// }}}
+// {{{ void calculateGateTime(void)
+// For N = T/s timestamps spaced s ticks apart with rms noise sigma the
+// relative error of the fitted slope is about sigma*sqrt(12*s) / T^1.5,
+// solve for the gate T that gives the requested number of digits.
+// In burst mode each of the r*T sub-gates in the gate adds sqrt(2)*sigma
+// to the summed span d*T, the error is sigma*sqrt(2*r*T) / (d*T).
+
+void calculateGateTime(void)
+{
+    uint64_t spacing;
+    uint64_t edges;
+    float    target;
+    float    gate;
+
+    Meas.Reg.Stride = 1;
+    spacing = (uint64_t)Meas.TimeBasePulsTest << Meas.DividerSetting;
+    if (spacing == 0)
+        spacing = REG_MIN_SPACING;
+
+    target = powf(10.0, -Meas.Precision) / GATE_MARGIN;
+    if (BurstMode && (Meas.BurstRate > 0))
+    {
+        gate = 2.0 * Meas.BurstRate * powf(Meas.NoiseTicks / (Meas.BurstDuty * target), 2.0);
+        // a gate holds at least one sub-gate, r*T < 1 is a single span
+        if (gate * Meas.BurstRate < 1.0)
+            gate = 1.4142 * Meas.NoiseTicks / (Meas.BurstDuty * target);
+        // a few bursts at least, once the last gate saw more than one;
+        // with a single burst the floor would grow the gate every time
+        if ((Meas.BurstSpans > 1) && (gate < 4.0 / Meas.BurstRate))
+            gate = 4.0 / Meas.BurstRate;
+    }
+    else
+        gate = powf(Meas.NoiseTicks * sqrtf(12.0 * spacing) / target, 2.0 / 3.0);
+    if (gate < 8.0 * spacing)
+        gate = 8.0 * spacing;
+    if (gate < GATE_MIN_TICKS)
+        gate = GATE_MIN_TICKS;
+    if (gate > GATE_MAX_TICKS)
+        gate = GATE_MAX_TICKS;
+    Meas.GateTimeFinal = gate;
+
+    // keep the sample count within the accumulator range
+    edges = Meas.GateTimeFinal / spacing;
+    if (edges > REG_MAX_SAMPLES)
+        Meas.Reg.Stride = (edges + REG_MAX_SAMPLES - 1) / REG_MAX_SAMPLES;
+
+    // channel B has no prescaler, its rate is limited to DUAL_MIN_SPACING
+    Meas.RegB.Stride = 1;
+    if (Meas.TimeBasePulsTestB != 0)
+    {
+        edges = Meas.GateTimeFinal / Meas.TimeBasePulsTestB;
+        if (edges > REG_MAX_SAMPLES)
+            Meas.RegB.Stride = (edges + REG_MAX_SAMPLES - 1) / REG_MAX_SAMPLES;
+    }
+}
+
+// }}}
+// {{{ void updateNoiseEstimate(void)
+// The scatter between successive readings is sqrt(2) times the error of
+// one reading, translate it back to timestamp noise and average it. A
+// burst reading is edges over summed spans, each span end adds sigma.
+
+void updateNoiseEstimate(void)
+{
+    float spacing;
+    float rel;
+    float sigma;
+
+    if ((Meas.PrevFrequencyMilliHz != 0) && (Meas.FrequencyMilliHz != 0) &&
+        (BurstMode ? (Meas.BurstSpans > 0) : (Meas.Reg.N > 2)))
+    {
+        rel = ((float)Meas.FrequencyMilliHz - (float)Meas.PrevFrequencyMilliHz) / Meas.FrequencyMilliHz;
+        rel = fabsf(rel) / sqrtf(2.0);
+        if (BurstMode)
+            sigma = rel * Meas.BurstTicks / sqrtf(2.0 * Meas.BurstSpans);
+        else
+        {
+            spacing = (float)Meas.Reg.TLast / (Meas.Reg.N - 1);
+            sigma = rel * powf(Meas.Reg.TLast, 1.5) / sqrtf(12.0 * spacing);
+        }
+        Meas.NoiseTicks += (sigma - Meas.NoiseTicks) / 8;
+        if (Meas.NoiseTicks < NOISE_FLOOR)
+            Meas.NoiseTicks = NOISE_FLOOR;
+    }
+    Meas.PrevFrequencyMilliHz = Meas.FrequencyMilliHz;
+}
+
+// }}}
+// {{{ void checkRange(void)
+// track the input period from the final gate, a new ranging gate is only
+// needed when the divider would change or no edges were seen
+
+void checkRange(void)
+{
+    uint32_t period;
+
+    if (BurstMode)
+    {
+        // keep the range through gates without a complete burst
+        if (Meas.BurstEdges < 2)
+            return;
+        period = Meas.BurstTicks / Meas.BurstEdges >> Meas.DividerSetting;
+        Meas.TimeBasePulsTest = period;
+        if (getDividerSetting(period) != Meas.DividerSetting)
+            Meas.RangeValid = FALSE;
+        return;
+    }
+    if (Meas.Reg.N < 3)
+    {
+        Meas.RangeValid = FALSE;
+        return;
+    }
+    period = Meas.Reg.TLast / ((uint32_t)(Meas.Reg.N - 1) * Meas.Reg.Stride) >> Meas.DividerSetting;
+    Meas.TimeBasePulsTest = period;
+    if (Meas.RegB.N > 2)
+        Meas.TimeBasePulsTestB = Meas.RegB.TLast / ((uint32_t)(Meas.RegB.N - 1) * Meas.RegB.Stride);
+    if (getDividerSetting(period) != Meas.DividerSetting)
+        Meas.RangeValid = FALSE;
+}
+
+// }}}
+// {{{ void gateReset(void)
+
+void gateReset(void)
+{
+    regReset(&Meas.Reg);
+    regReset(&Meas.RegB);
+    Meas.IntervalSum = 0;
+    Meas.IntervalN = 0;
+    Meas.IntervalLate = 0;
+    Meas.BTooFast = FALSE;
+    Meas.BurstEdges = 0;
+    Meas.BurstTicks = 0;
+    Meas.BurstSpans = 0;
+    Meas.Bursts = 0;
+    BurstSeen = FALSE;
+    BurstSegN = 0;
+    BurstSkip = FALSE;
+    StrideCount = 0;
+    StrideCountB = 0;
+    LastAValid = FALSE;
+    LastBValid = FALSE;
+    GateStarted = FALSE;
+#ifndef TESTING
+    // drop an edge latched while INT0 was off
+    EIFR = _BV(INTF0);
+    EIMSK = DUALMODE(CommandRegister) ? _BV(INT0) : 0;
+#endif
+}
+
+// }}}
+// {{{ void captureChannelA(uint32_t ticks)
+// every prescaled channel A edge while the gate is open, the gate ends
+// with the first edge GateTimeFinal ticks after the first one
+
+void captureChannelA(uint32_t ticks)
+{
+    if (!GateStarted)
+    {
+        GateStart = ticks;
+        GateStarted = TRUE;
+    } else if ((ticks - GateStart) >= Meas.GateTimeFinal)
+    {
+        GateOpen = FALSE;
+        return;
+    }
+    if (BurstMode)
+    {
+        captureBurst(ticks);
+        return;
+    }
+    LastA = ticks;
+    LastAValid = TRUE;
+    if (++StrideCount >= Meas.Reg.Stride)
+    {
+        StrideCount = 0;
+        regAddSample(&Meas.Reg, ticks);
+    }
+}
+
+// }}}
+// {{{ void captureChannelB(uint32_t ticks, uint8_t late)
+// every channel B edge while the gate is open, the first one after an A
+// edge closes an A->B interval unless its timestamp may be late; the fit
+// keeps late ones, dropping a sample would shift k. Sets BTooFast and
+// ignores the edge when channel B is above its rate limit.
+
+void captureChannelB(uint32_t ticks, uint8_t late)
+{
+    if (LastBValid && ((ticks - LastB) < DUAL_MIN_SPACING - INT0_HOLDOFF))
+    {
+        Meas.BTooFast = TRUE;
+        return;
+    }
+    LastB = ticks;
+    LastBValid = TRUE;
+    if (LastAValid)
+    {
+        if (late)
+            Meas.IntervalLate++;
+        else
+        {
+            Meas.IntervalSum += ticks - LastA;
+            Meas.IntervalN++;
+        }
+        LastAValid = FALSE;
+    }
+    if ((++StrideCountB >= Meas.RegB.Stride) && (Meas.RegB.N < REG_MAX_SAMPLES))
+    {
+        StrideCountB = 0;
+        regAddSample(&Meas.RegB, ticks);
+    }
+}
+
+// }}}
+// {{{ void captureBurst(uint32_t ticks)
+// burst mode edges: find the bursts by their gaps and sum the edges that
+// fall into each burst's sub-gate
+
+void captureBurst(uint32_t ticks)
+{
+    uint32_t dt;
+
+    if (!BurstSeen || ((ticks - BurstLast) > Meas.BurstGap))
+    {
+        burstClose();
+        // the delay needs the true burst start, not the gate opening
+        BurstSkip = !BurstSeen && (Meas.BurstDelay || Meas.BurstWidth);
+        BurstStart = ticks;
+        BurstSeen = TRUE;
+        Meas.Bursts++;
+    }
+    BurstLast = ticks;
+    if (BurstSkip)
+        return;
+    dt = ticks - BurstStart;
+    if ((dt < Meas.BurstDelay) || (Meas.BurstWidth && (dt - Meas.BurstDelay > Meas.BurstWidth)))
+        return;
+    if (BurstSegN == 0)
+        BurstSegFirst = ticks;
+    BurstSegLast = ticks;
+    BurstSegN++;
+}
+
+// }}}
+// {{{ void burstClose(void)
+// end of a burst or of the gate, fold the sub-gate into the sums
+
+void burstClose(void)
+{
+    if (BurstSegN > 1)
+    {
+        Meas.BurstEdges += BurstSegN - 1;
+        Meas.BurstTicks += BurstSegLast - BurstSegFirst;
+        Meas.BurstSpans++;
+    }
+    BurstSegN = 0;
+}
+
+// }}}
+// {{{ void getCounterValue(void)
+
+void getCounterValue(void)
+{
+    Meas.CounterValue = Meas.TimeBasePulsFinal;
+}
+
+// }}}
+// {{{ void calculateDisplayValue(void)
+// scale the reading to Precision significant digits and pick the unit
+
+void calculateDisplayValue(void)
+{
+    uint64_t value;
+    uint8_t  base;
+    short    exponent = 0;
+    short    j;
+    uint64_t limit = 1;
+    short    fixed = 0;
+
+    if (BurstMode)
+        Meas.FrequencyMilliHz = Meas.BurstTicks ? mulDiv64((uint64_t)Meas.BurstEdges * Meas.PortPrescaler,
+                                    TIMEBASE_FREQUENCY * 1000ULL, Meas.BurstTicks) : 0;
+    else
+        Meas.FrequencyMilliHz = regFrequencyMilliHz(&Meas.Reg, Meas.PortPrescaler);
+    updateNoiseEstimate();
+    Meas.ValueValid = TRUE;
+    switch (CommandRegister & MASK_MODE)
+    {
+        case FREQUENCY :
+        case BURST :
+            value = Meas.FrequencyMilliHz;   // mHz
+            base = 0;
+            break;
+        case PERIOD :
+            value = Meas.FrequencyMilliHz ? 1000000000000000ULL / Meas.FrequencyMilliHz : 0;  // ps
+            base = 4;
+            break;
+        case PULSEHI :
+        case PULSELO :
+            // pulse width needs both edges, the capture only sees rising ones
+            Meas.ValueValid = FALSE;
+            value = 0;
+            base = 9;
+            break;
+        case RATIO :
+            Meas.ValueValid = !Meas.BTooFast;
+            Meas.FrequencyBMilliHz = regFrequencyMilliHz(&Meas.RegB, 1);
+            value = Meas.FrequencyBMilliHz ? mulDiv64(Meas.FrequencyMilliHz, 1000000000, Meas.FrequencyBMilliHz) : 0;
+            base = 9;
+            fixed = 9;
+            break;
+        case INTERVAL :
+            Meas.ValueValid = !Meas.BTooFast;
+            value = Meas.IntervalN ? Meas.IntervalSum * (1000000000000ULL / TIMEBASE_FREQUENCY) / Meas.IntervalN : 0;  // ps
+            base = 4;
+            break;
+        default :
+            value = (uint64_t)Meas.Reg.N * Meas.Reg.Stride * Meas.PortPrescaler;
+            base = 9;
+            break;
+    }
+
+    if (!Meas.ValueValid)
+    {
+        Meas.DisplayValue = 0;
+        Meas.DecimalPosition = 0;
+        Meas.UnitIndex = 9;
+        return;
+    }
+    for (j=0; j<Meas.Precision; j++)
+        limit *= 10;
+    while (value >= limit)
+    {
+        value = (value + 5) / 10;
+        exponent++;
+    }
+    if (base == 9)
+    {
+        // no unit, fixed decimals
+        Meas.DecimalPosition = fixed - exponent;
+        while (Meas.DecimalPosition < 0)
+        {
+            value *= 10;
+            Meas.DecimalPosition++;
+        }
+        Meas.DisplayValue = value;
+        Meas.UnitIndex = base;
+        return;
+    }
+    // value * 10^exponent base units, keep 1..3 digits before the point
+    j = (exponent + Meas.Precision - 1) / 3;
+    if (j > 4)
+        j = 4;
+    Meas.DecimalPosition = 3 * j - exponent;
+    while (Meas.DecimalPosition < 0)
+    {
+        value *= 10;
+        Meas.DecimalPosition++;
+    }
+    Meas.DisplayValue = value;
+    Meas.UnitIndex = base + j;
+}
+
+// }}}
+// {{{ void showValueOnDisplay(void)
+
+void showValueOnDisplay(void)
+{
+#ifdef TESTING
+    if (OutputMode != OUT_TUI)
+        return;
+#endif
+    //if (PrevValue != DisplayValue)
+    {
+        layo_ShowValue(Meas.DisplayValue,Meas.DecimalPosition);
+        layo_bg_units(getUnits());
+        Meas.PrevValue = Meas.DisplayValue;
+    }
+}
+
+// }}}
+
+// {{{ uint8_t getDividerSetting(pulses)
+
+uint8_t getDividerSetting(uint64_t pulses)
+{
+    uint8_t  n = 0;
+    uint64_t divided;
+    uint16_t spacing = DUALMODE(CommandRegister) ? DUAL_MIN_SPACING : REG_MIN_SPACING;
+    do  
+    {
+        n++;
+        divided  = pulses << n;
+    }
+    while ((divided < spacing) && (n<31));
+    return n;
+}
+
+// }}}
+// {{{ Regression estimator
+// Least squares fit of t[k] = a + b*k, k = 0..N-1, over timebase
+// timestamps taken every Stride prescaled input edges. Because k is
+// implied by the sample index, sum(k) and sum(k*k) are closed form and
+// only sum(t) and sum(k*t) are needed. The capture interrupt keeps sum(t)
+// and P, the sum of its running values, two additions per sample:
+// sum(k*t) = N*sum(t) - P.
+//
+//   b = (12*sum(k*t) - 6*(N-1)*sum(t)) / (N*(N*N-1))    ticks per sample
+
+// {{{ void regReset(struct regression *r)
+
+void regReset(struct regression *r)
+{
+    r->N = 0;
+    r->T0 = 0;
+    r->TLast = 0;
+    r->SumT = 0;
+    r->SumP = 0;
+}
+
+// }}}
+// {{{ void regAddSample(struct regression *r, uint32_t ticks)
+// runs in the capture interrupt, additions only
+
+void regAddSample(struct regression *r, uint32_t ticks)
+{
+    uint32_t t;
+    if (r->N == 0)
+        r->T0 = ticks;
+    t = ticks - r->T0;        // wraps correctly on a free running counter
+    r->SumT += t;
+    r->SumP += r->SumT;
+    r->TLast = t;
+    r->N++;
+}
+
+// }}}
+// {{{ uint64_t regFrequencyMilliHz(struct regression *r, uint32_t prescaler)
+
+uint64_t regFrequencyMilliHz(struct regression *r, uint32_t prescaler)
+{
+    uint64_t n = r->N;
+    uint64_t num;
+    uint64_t den;
+
+    if (n < 3)
+        return 0;
+    // sum(k*t) = N*sum(t) - sum of the running sums
+    num = 12 * (n * r->SumT - r->SumP) - 6 * (n - 1) * r->SumT;
+    den = n * (n * n - 1);
+    if (num == 0)
+        return 0;
+    // f = TIMEBASE * stride * prescaler / b
+    return mulDiv64((uint64_t)TIMEBASE_FREQUENCY * 1000 * r->Stride * prescaler, den, num);
+}
+
+// }}}
+// {{{ Hold capture
+// Edge timestamps in CaptureBuffer: the first is kept in CaptureFirst, the
+// first period as a varint, every further edge as a zigzag varint of the
+// difference with the previous period.
+
+// {{{ void captureReset(void)
+
+void captureReset(void)
+{
+    CaptureLen = 0;
+    CaptureEdges = 0;
+    CapturePrevDelta = 0;
+    CaptureAnalysed = FALSE;
+    CaptureStreamPos = 0;
+}
+
+// }}}
+// {{{ uint8_t captureAddEdge(uint32_t ticks)
+// returns FALSE when the buffer is full
+
+uint8_t captureAddEdge(uint32_t ticks)
+{
+    int32_t  delta;
+    uint32_t v;
+
+    if (CaptureLen > CAPTURE_BYTES - VARINT_MAX)
+        return FALSE;
+    if (CaptureEdges == 0)
+    {
+        CaptureFirst = ticks;
+    } else
+    {
+        delta = ticks - CapturePrev;
+        if (CaptureEdges == 1)
+            v = delta;
+        else
+            v = ((uint32_t)(delta - CapturePrevDelta) << 1) ^ ((delta - CapturePrevDelta) >> 31);
+        CapturePrevDelta = delta;
+        while (v >= 0x80)
+        {
+            CaptureBuffer[CaptureLen++] = v | 0x80;
+            v >>= 7;
+        }
+        CaptureBuffer[CaptureLen++] = v;
+    }
+    CapturePrev = ticks;
+    CaptureEdges++;
+    return TRUE;
+}
+
+// }}}
+// {{{ uint32_t captureNextPeriod(uint16_t *pos, int32_t *delta)
+// decode the next period, start with *pos = 0
+
+uint32_t captureNextPeriod(uint16_t *pos, int32_t *delta)
+{
+    uint32_t v = 0;
+    uint8_t  shift = 0;
+    uint8_t  b;
+    uint8_t  first = (*pos == 0);
+
+    do
+    {
+        b = CaptureBuffer[(*pos)++];
+        v |= (uint32_t)(b & 0x7F) << shift;
+        shift += 7;
+    }
+    while (b & 0x80);
+    if (first)
+        *delta = v;
+    else
+        *delta += (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+    return *delta;
+}
+
+// }}}
+// {{{ void captureAnalyse(void)
+
+void captureAnalyse(void)
+{
+    uint16_t pos = 0;
+    int32_t  delta = 0;
+    uint32_t period;
+    uint64_t sum = 0;
+    uint32_t dev;
+    uint32_t maxDev = 0;
+
+    CaptureMinPeriod = 0xFFFFFFFF;
+    CaptureMaxPeriod = 0;
+    CaptureMaxEdge = 0;
+    for (uint16_t i=1; i<CaptureEdges; i++)
+    {
+        period = captureNextPeriod(&pos, &delta);
+        sum += period;
+        if (period < CaptureMinPeriod)
+            CaptureMinPeriod = period;
+        if (period > CaptureMaxPeriod)
+            CaptureMaxPeriod = period;
+    }
+    CaptureMeanPeriod = (CaptureEdges > 1) ? sum / (CaptureEdges - 1) : 0;
+
+    pos = 0;
+    delta = 0;
+    for (uint16_t i=1; i<CaptureEdges; i++)
+    {
+        period = captureNextPeriod(&pos, &delta);
+        dev = (period > CaptureMeanPeriod) ? period - CaptureMeanPeriod : CaptureMeanPeriod - period;
+        if (dev > maxDev)
+        {
+            maxDev = dev;
+            CaptureMaxEdge = i;
+        }
+    }
+    CaptureAnalysed = TRUE;
+}
+
+// }}}
+// {{{ void holdCapture(void)
+// display is frozen, fill the buffer then show the analysis once
+
+void holdCapture(void)
+{
+#ifdef TESTING
+    uint64_t n = simFirstEdge();
+    uint32_t t = (uint32_t)SimTime;
+    while (Capturing)
+    {
+        t = simEdgeTicks(n++);
+        if (simBurstActive(t) && !captureAddEdge(t))
+            Capturing = FALSE;
+    }
+    simClockGate(t);
+#endif
+    if (!Capturing && !CaptureAnalysed)
+    {
+        captureAnalyse();
+#ifdef TESTING
+        jitterCapture();
+        if (OutputMode == OUT_TUI)
+#endif
+            layo_ShowCapture();
+    }
+    if (CaptureAnalysed)
+        streamCapture();
+}
+
+// }}}
+
+// }}}
+// {{{ Binary stream
+// Frames go into the TX ring and are drained by the USART data register
+// empty interrupt (or a non-blocking write in the simulator). A frame that
+// does not fit is dropped and counted, output never blocks the main loop.
+
+// {{{ uint16_t crc16Update(uint16_t crc, uint8_t b)
+
+uint16_t crc16Update(uint16_t crc, uint8_t b)
+{
+    crc ^= (uint16_t)b << 8;
+    for (uint8_t i=0; i<8; i++)
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    return crc;
+}
+
+// }}}
+// {{{ void putLE(uint8_t *p, uint64_t v, uint8_t n)
+
+void putLE(uint8_t *p, uint64_t v, uint8_t n)
+{
+    while (n--)
+    {
+        *p++ = v;
+        v >>= 8;
+    }
+}
+
+// }}}
+// {{{ void streamInit(void)
+
+void streamInit(void)
+{
+    TxHead = 0;
+    TxTail = 0;
+#ifndef TESTING
+    UCSR0A = _BV(U2X0);
+    UBRR0 = (F_CPU + 4UL * STREAM_BAUD) / (8UL * STREAM_BAUD) - 1;
+    UCSR0B = _BV(TXEN0);
+    UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+    StreamEnabled = TRUE;
+#endif
+}
+
+// }}}
+// {{{ uint8_t streamFrame(uint8_t type, uint8_t *payload, uint8_t len)
+// returns FALSE when the frame was dropped
+
+uint8_t streamFrame(uint8_t type, uint8_t *payload, uint8_t len)
+{
+    uint8_t  head = TxHead;
+    uint8_t  room = TxTail - head - 1;
+    uint16_t crc = 0xFFFF;
+
+#ifdef TESTING
+    ringRecord(type, payload, len);
+#endif
+    if (!StreamEnabled)
+        return FALSE;
+    if (room < len + FRAME_OVERHEAD)
+    {
+        StreamDropped++;
+        return FALSE;
+    }
+    TxBuf[head++] = STREAM_SYNC;
+    TxBuf[head++] = type;
+    TxBuf[head++] = len;
+    crc = crc16Update(crc, type);
+    crc = crc16Update(crc, len);
+    for (uint8_t i=0; i<len; i++)
+    {
+        TxBuf[head++] = payload[i];
+        crc = crc16Update(crc, payload[i]);
+    }
+    TxBuf[head++] = crc;
+    TxBuf[head++] = crc >> 8;
+    TxHead = head;
+#ifndef TESTING
+    UCSR0B |= _BV(UDRIE0);
+#endif
+    return TRUE;
+}
+
+// }}}
+// {{{ void streamReading(void)
+// time(4) cmdreg(1) divider(1) stride(2) samples(2) span ticks(4)
+// frequency mHz(8) display value(4) decimal position(1) unit(1)
+// frames dropped so far(2)
+
+void streamReading(void)
+{
+    uint8_t p[READING_LEN];
+
+    putLE(p +  0, OurTime, 4);
+    putLE(p +  4, CommandRegister, 1);
+    putLE(p +  5, Meas.DividerSetting, 1);
+    putLE(p +  6, Meas.Reg.Stride, 2);
+    putLE(p +  8, Meas.Reg.N, 2);
+    putLE(p + 10, Meas.TimeBasePulsFinal, 4);
+    putLE(p + 14, Meas.FrequencyMilliHz, 8);
+    putLE(p + 22, Meas.DisplayValue, 4);
+    putLE(p + 26, Meas.DecimalPosition, 1);
+    putLE(p + 27, Meas.UnitIndex, 1);
+    putLE(p + 28, StreamDropped, 2);
+    streamFrame(FRAME_READING, p, READING_LEN);
+}
+
+// }}}
+// {{{ void streamCapture(void)
+// first timestamp(4) edges(2) offset(2) encoded capture bytes(..32),
+// called until the whole buffer went out
+
+void streamCapture(void)
+{
+    uint8_t p[8 + CAPTURE_CHUNK];
+    uint8_t n;
+
+    while (StreamEnabled && (CaptureStreamPos < CaptureLen))
+    {
+        n = (CaptureLen - CaptureStreamPos > CAPTURE_CHUNK) ? CAPTURE_CHUNK : CaptureLen - CaptureStreamPos;
+        putLE(p + 0, CaptureFirst, 4);
+        putLE(p + 4, CaptureEdges, 2);
+        putLE(p + 6, CaptureStreamPos, 2);
+        memcpy(p + 8, CaptureBuffer + CaptureStreamPos, n);
+        if ((uint8_t)(TxTail - TxHead - 1) < n + 8 + FRAME_OVERHEAD)
+            break;      // no room now, continue on the next pass
+        streamFrame(FRAME_CAPTURE, p, n + 8);
+        CaptureStreamPos += n;
+    }
+}
+
+// }}}
+// {{{ void streamService(void)
+
+void streamService(void)
+{
+#ifdef TESTING
+    ssize_t n;
+    uint8_t tail;
+
+    while ((StreamFd >= 0) && (TxTail != TxHead))
+    {
+        tail = TxTail;
+        // contiguous part of the ring
+        n = (TxHead > tail) ? TxHead - tail : TXBUF_SIZE - tail;
+        n = write(StreamFd, TxBuf + tail, n);
+        if (n <= 0)
+            break;      // EAGAIN, reader is slow
+        TxTail = tail + n;
+    }
+#endif
+}
+
+// }}}
+#ifdef TESTING
+// {{{ int streamOpen(char *path)
+// "pty" creates a pseudo terminal, anything else is opened as file/fifo
+
+int streamOpen(char *path)
+{
+    struct termios t;
+
+    if (strcmp(path, "pty") == 0)
+    {
+        StreamFd = posix_openpt(O_RDWR | O_NOCTTY);
+        if ((StreamFd < 0) || grantpt(StreamFd) || unlockpt(StreamFd))
+            return FALSE;
+        tcgetattr(StreamFd, &t);
+        cfmakeraw(&t);
+        tcsetattr(StreamFd, TCSANOW, &t);
+        fprintf(stderr, "stream on %s\n", ptsname(StreamFd));
+    } else
+    {
+        StreamFd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (StreamFd < 0)
+            return FALSE;
+    }
+    fcntl(StreamFd, F_SETFL, fcntl(StreamFd, F_GETFL) | O_NONBLOCK);
+    StreamEnabled = TRUE;
+    return TRUE;
+}
+
+// }}}
+// {{{ Ring file recorder
+// Every stream frame, and with -E the raw channel A edges, also goes into
+// a memory mapped ring file: no syscall per record, fixed size on disk,
+// analysis tools map it read-only and follow Head (see struct ringHeader).
+
+// {{{ int ringOpen(char *arg)
+// "path[:records]", an existing ring of the same size keeps its contents
+
+int ringOpen(char *arg)
+{
+    char    *path = strdup(arg);
+    char    *colon = strrchr(path, ':');
+    uint64_t records = RING_RECORDS;
+    size_t   size;
+    int      fd;
+    struct stat st;
+
+    if (colon)
+    {
+        *colon = 0;
+        records = strtoull(colon + 1, NULL, 10);
+        if (records == 0)
+            records = RING_RECORDS;
+    }
+    size = sizeof(struct ringHeader) + records * sizeof(struct ringRecord);
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    free(path);
+    if ((fd < 0) || fstat(fd, &st))
+        return FALSE;
+    if (((size_t)st.st_size != size) && ftruncate(fd, size))
+        return FALSE;
+    Ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (Ring == MAP_FAILED)
+    {
+        Ring = NULL;
+        return FALSE;
+    }
+    RingData = (struct ringRecord *)(Ring + 1);
+    if ((memcmp(Ring->Magic, RING_MAGIC, 8) != 0) || (Ring->Capacity != records) ||
+        (Ring->RecordSize != sizeof(struct ringRecord)))
+    {
+        memset(Ring, 0, size);
+        Ring->HeaderSize = sizeof(struct ringHeader);
+        Ring->RecordSize = sizeof(struct ringRecord);
+        Ring->Capacity = records;
+        memcpy(Ring->Magic, RING_MAGIC, 8);
+    }
+    return TRUE;
+}
+
+// }}}
+// {{{ void ringRecord(uint8_t type, uint8_t *payload, uint8_t len)
+
+void ringRecord(uint8_t type, uint8_t *payload, uint8_t len)
+{
+    struct ringRecord *r;
+    uint64_t head;
+
+    if (!Ring)
+        return;
+    head = Ring->Head;
+    r = &RingData[head % Ring->Capacity];
+    __atomic_store_n(&r->Seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    if (len > RING_PAYLOAD)
+        len = RING_PAYLOAD;
+    r->Type = type;
+    r->Len = len;
+    memcpy(r->Payload, payload, len);
+    __atomic_store_n(&r->Seq, head + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&Ring->Head, head + 1, __ATOMIC_RELEASE);
+}
+
+// }}}
+// {{{ void ringEdge(uint32_t ticks)
+// count(1) gate start(1) reserved(2) timestamps(4 each), RING_EDGE_MAX
+// per record
+
+void ringEdge(uint32_t ticks)
+{
+    if (!RingEdgesOn)
+        return;
+    if (RingEdgeCount == 0)
+    {
+        RingEdgeBuf[1] = RingEdgeNewGate;   // not contiguous with the last record
+        RingEdgeNewGate = FALSE;
+    }
+    putLE(RingEdgeBuf + 4 + 4 * RingEdgeCount, ticks, 4);
+    if (++RingEdgeCount == RING_EDGE_MAX)
+    {
+        RingEdgeBuf[0] = RingEdgeCount;
+        ringRecord(RING_EDGES, RingEdgeBuf, 4 + 4 * RingEdgeCount);
+        RingEdgeCount = 0;
+    }
+}
+
+// }}}
+// {{{ void ringEdgeFlush(void)
+// end of a gate
+
+void ringEdgeFlush(void)
+{
+    RingEdgeNewGate = TRUE;
+    if (RingEdgeCount == 0)
+        return;
+    RingEdgeBuf[0] = RingEdgeCount;
+    ringRecord(RING_EDGES, RingEdgeBuf, 4 + 4 * RingEdgeCount);
+    RingEdgeCount = 0;
+}
+
+// }}}
+// {{{ int streamRecord(char *path)
+// host side: decode the firmware stream from a serial port or file into
+// the ring, until end of file or a signal
+
+int streamRecord(char *path)
+{
+    struct termios t;
+    struct sigaction sa;
+    uint8_t  buf[256];
+    uint8_t  payload[255];
+    uint8_t  state = 0;
+    uint8_t  type = 0;
+    uint8_t  len = 0;
+    uint8_t  pos = 0;
+    uint16_t crc = 0;
+    uint32_t frames = 0;
+    uint32_t errors = 0;
+    ssize_t  n;
+    int      fd;
+
+    if (!Ring)
+    {
+        fprintf(stderr, "-i needs a ring file (-r)\n");
+        return 1;
+    }
+    fd = open(path, O_RDONLY | O_NOCTTY);
+    if (fd < 0)
+    {
+        perror(path);
+        return 1;
+    }
+    if (isatty(fd))
+    {
+        tcgetattr(fd, &t);
+        cfmakeraw(&t);
+        cfsetspeed(&t, B115200);
+        tcsetattr(fd, TCSANOW, &t);
+    }
+    // no SA_RESTART, a signal has to end the blocking read
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stopHandler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    while (!ExitMainLoop && ((n = read(fd, buf, sizeof(buf))) != 0))
+    {
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror(path);
+            break;
+        }
+        for (ssize_t i=0; i<n; i++)
+        {
+            uint8_t b = buf[i];
+            switch (state)
+            {
+                case 0 :    // sync
+                    if (b == STREAM_SYNC)
+                        state = 1;
+                    break;
+                case 1 :    // type
+                    type = b;
+                    crc = crc16Update(0xFFFF, b);
+                    state = 2;
+                    break;
+                case 2 :    // length
+                    len = b;
+                    pos = 0;
+                    crc = crc16Update(crc, b);
+                    state = len ? 3 : 4;
+                    break;
+                case 3 :    // payload
+                    payload[pos++] = b;
+                    crc = crc16Update(crc, b);
+                    if (pos == len)
+                        state = 4;
+                    break;
+                case 4 :    // crc low byte
+                    crc ^= b;
+                    state = 5;
+                    break;
+                case 5 :    // crc high byte
+                    if ((crc ^ ((uint16_t)b << 8)) == 0)
+                    {
+                        ringRecord(type, payload, len);
+                        frames++;
+                    } else
+                        errors++;   // resync on the next sync byte
+                    state = 0;
+                    break;
+            }
+        }
+    }
+    fprintf(stderr, "%lu frames recorded, %lu bad\n", (unsigned long)frames, (unsigned long)errors);
+    return 0;
+}
+
+// }}}
+
+// }}}
+// {{{ Jitter analysis
+// Period jitter, cycle to cycle jitter, TIE and a periodogram of the
+// period deviations. The kernels work on four doubles at a time through
+// the GCC vector extension, which maps onto SSE2/AVX on the host.
+
+// {{{ jitLoad(p), jitMin(a, b), jitMax(a, b)
+// macros rather than functions, vector arguments would change the ABI
+
+#define jitLoad(p)      ({ v4d v_; memcpy(&v_, (p), sizeof(v_)); v_; })
+#define jitSelect(m, a, b) ((v4d)(((v4l)(a) & (m)) | ((v4l)(b) & ~(m))))
+#define jitMin(a, b)    jitSelect((a) < (b), a, b)
+#define jitMax(a, b)    jitSelect((a) > (b), a, b)
+
+// }}}
+// {{{ void jitMoments(const double *x, uint32_t n, double *r)
+// r = sum, sum of squares, min, max
+
+void jitMoments(const double *x, uint32_t n, double *r)
+{
+    v4d s = { 0 }, q = { 0 }, lo, hi, v;
+    uint32_t i = 0;
+
+    lo = hi = (v4d){ x[0], x[0], x[0], x[0] };
+    for (; i + 4 <= n; i += 4)
+    {
+        v = jitLoad(x + i);
+        s += v;
+        q += v * v;
+        lo = jitMin(lo, v);
+        hi = jitMax(hi, v);
+    }
+    r[0] = s[0] + s[1] + s[2] + s[3];
+    r[1] = q[0] + q[1] + q[2] + q[3];
+    r[2] = fmin(fmin(lo[0], lo[1]), fmin(lo[2], lo[3]));
+    r[3] = fmax(fmax(hi[0], hi[1]), fmax(hi[2], hi[3]));
+    for (; i < n; i++)
+    {
+        r[0] += x[i];
+        r[1] += x[i] * x[i];
+        r[2] = fmin(r[2], x[i]);
+        r[3] = fmax(r[3], x[i]);
+    }
+}
+
+// }}}
+// {{{ void jitDiff(const double *x, uint32_t n, double *d)
+// d[i] = x[i+1] - x[i], n - 1 results
+
+void jitDiff(const double *x, uint32_t n, double *d)
+{
+    uint32_t i = 0;
+    v4d v;
+
+    for (; i + 5 <= n; i += 4)
+    {
+        v = jitLoad(x + i + 1) - jitLoad(x + i);
+        memcpy(d + i, &v, sizeof(v));
+    }
+    for (; i + 1 < n; i++)
+        d[i] = x[i+1] - x[i];
+}
+
+// }}}
+// {{{ void jitDetrend(double *t, uint32_t n)
+// least squares line through t[i] over i, t becomes the residual
+
+void jitDetrend(double *t, uint32_t n)
+{
+    v4d st = { 0 }, skt = { 0 }, k = { 0, 1, 2, 3 }, a, b, v;
+    const v4d four = { 4, 4, 4, 4 };
+    double sumT, sumKT, slope, icept;
+    uint32_t i = 0;
+
+    for (; i + 4 <= n; i += 4, k += four)
+    {
+        v = jitLoad(t + i);
+        st += v;
+        skt += k * v;
+    }
+    sumT = st[0] + st[1] + st[2] + st[3];
+    sumKT = skt[0] + skt[1] + skt[2] + skt[3];
+    for (; i < n; i++)
+    {
+        sumT += t[i];
+        sumKT += (double)i * t[i];
+    }
+    // same closed form as the regression estimator
+    slope = (12.0 * sumKT - 6.0 * (n - 1) * sumT) / ((double)n * ((double)n * n - 1));
+    icept = sumT / n - slope * (n - 1) / 2.0;
+
+    a = (v4d){ icept, icept, icept, icept };
+    b = (v4d){ slope, slope, slope, slope };
+    k = (v4d){ 0, 1, 2, 3 };
+    for (i = 0; i + 4 <= n; i += 4, k += four)
+    {
+        v = jitLoad(t + i) - (a + b * k);
+        memcpy(t + i, &v, sizeof(v));
+    }
+    for (; i < n; i++)
+        t[i] -= icept + slope * i;
+}
+
+// }}}
+// {{{ uint32_t jitPeriodogram(const double *x, uint32_t n, double *pw)
+// Bartlett periodogram: DFTs of JIT_SEGMENT sample blocks at (k+1) /
+// JIT_SEGMENT cycles per sample, by rotating phasors four bins per vector.
+// The block powers of one run are added to pw, returns the block count.
+
+uint32_t jitPeriodogram(const double *x, uint32_t n, double *pw)
+{
+    v4d zr[JIT_FREQS/4], zi[JIT_FREQS/4], wr[JIT_FREQS/4], wi[JIT_FREQS/4];
+    v4d ar[JIT_FREQS/4], ai[JIT_FREQS/4], sum[JIT_FREQS/4];
+    v4d xv, r;
+    const v4d one = { 1, 1, 1, 1 };
+    double w;
+    uint32_t i, k, b, blocks = n / JIT_SEGMENT;
+
+    for (k=0; k<JIT_FREQS; k++)
+    {
+        w = -2 * M_PI * (k + 1) / JIT_SEGMENT;
+        wr[k/4][k%4] = cos(w);
+        wi[k/4][k%4] = sin(w);
+        sum[k/4][k%4] = ar[k/4][k%4] = ai[k/4][k%4] = 0;
+    }
+    for (i=0; i<blocks*JIT_SEGMENT; i++)
+    {
+        if (i % JIT_SEGMENT == 0)
+        {
+            for (b=0; b<JIT_FREQS/4; b++)
+            {
+                sum[b] += ar[b] * ar[b] + ai[b] * ai[b];
+                zr[b] = one;
+                zi[b] = ar[b] = ai[b] = one - one;
+            }
+        }
+        xv = (v4d){ x[i], x[i], x[i], x[i] };
+        for (b=0; b<JIT_FREQS/4; b++)
+        {
+            ar[b] += xv * zr[b];
+            ai[b] += xv * zi[b];
+            r     = zr[b] * wr[b] - zi[b] * wi[b];
+            zi[b] = zr[b] * wi[b] + zi[b] * wr[b];
+            zr[b] = r;
+        }
+    }
+    for (b=0; b<JIT_FREQS/4; b++)
+        sum[b] += ar[b] * ar[b] + ai[b] * ai[b];
+    for (k=0; k<JIT_FREQS; k++)
+        pw[k] += sum[k/4][k%4];
+    return blocks;
+}
+
+// }}}
+// {{{ void jitterAnalyse(double *periods, const uint32_t *ends, uint32_t runs, struct jitter *j)
+// periods in ticks, the array is used as scratch space. ends[r] is the end
+// of run r, the edges of different runs have no common time line: c2c,
+// the periodogram blocks and the TIE line fit stay inside one run.
+
+void jitterAnalyse(double *periods, const uint32_t *ends, uint32_t runs, struct jitter *j)
+{
+    double   r[4];
+    double   pw[JIT_FREQS] = { 0 };
+    double  *d;
+    double   t;
+    double   width;
+    uint32_t n = runs ? ends[runs-1] : 0;
+    uint32_t i;
+    uint32_t k;
+    uint32_t bin;
+    uint32_t start;
+    uint32_t len;
+    uint32_t m = 0;
+    uint32_t blocks = 0;
+
+    memset(j, 0, sizeof(*j));
+    if (n < 3)
+        return;
+    d = malloc(n * sizeof(double));
+    if (!d)
+        return;
+    j->Periods = n;
+
+    jitMoments(periods, n, r);
+    j->MeanPeriod = r[0] / n;
+    j->PeriodRms = sqrt(fmax(r[1] / n - j->MeanPeriod * j->MeanPeriod, 0));
+    j->PeriodMin = r[2];
+    j->PeriodMax = r[3];
+
+    width = (j->PeriodMax - j->PeriodMin) / JIT_BINS;
+    for (i=0; i<n; i++)
+    {
+        bin = (width > 0) ? (uint32_t)((periods[i] - j->PeriodMin) / width) : 0;
+        j->Hist[(bin < JIT_BINS) ? bin : JIT_BINS - 1]++;
+    }
+
+    for (k=0, start=0; k<runs; start=ends[k++])
+    {
+        len = ends[k] - start;
+        jitDiff(periods + start, len, d + m);
+        m += (len > 1) ? len - 1 : 0;
+    }
+    if (m)
+    {
+        jitMoments(d, m, r);
+        j->C2cRms = sqrt(r[1] / m);
+        j->C2cMax = fmax(-r[2], r[3]);
+    }
+
+    // period deviations for the periodogram
+    for (i=0; i<n; i++)
+        d[i] = periods[i] - j->MeanPeriod;
+    for (k=0, start=0; k<runs; start=ends[k++])
+        blocks += jitPeriodogram(d + start, ends[k] - start, pw);
+    for (k=0; k<JIT_FREQS; k++)
+    {
+        j->Psd[k] = blocks ? 2.0 * sqrt(pw[k] / blocks) / JIT_SEGMENT : 0;
+        if (j->Psd[k] > j->SpurAmp)
+        {
+            j->SpurAmp = j->Psd[k];
+            j->SpurFreq = (k + 1) / (double)JIT_SEGMENT;
+        }
+    }
+
+    // edge times relative to the first edge of the run, TIE is the
+    // residual of a line per run, runs too short for a fit are left out
+    m = 0;
+    for (k=0, start=0; k<runs; start=ends[k++])
+    {
+        len = ends[k] - start;
+        if (len < 3)
+            continue;
+        t = 0;
+        for (i=0; i<len; i++)
+        {
+            t += periods[start + i];
+            d[m + i] = t;
+        }
+        jitDetrend(d + m, len);
+        m += len;
+    }
+    if (m)
+    {
+        jitMoments(d, m, r);
+        j->TieRms = sqrt(r[1] / m);
+        j->TiePP = r[3] - r[2];
+    }
+    free(d);
+}
+
+// }}}
+// {{{ void jitterCapture(void)
+// analyse the hold capture buffer into Jitter
+
+void jitterCapture(void)
+{
+    uint16_t pos = 0;
+    int32_t  delta = 0;
+    uint32_t end;
+    double  *p;
+
+    if (CaptureEdges < 4)
+    {
+        memset(&Jitter, 0, sizeof(Jitter));
+        return;
+    }
+    p = malloc((CaptureEdges - 1) * sizeof(double));
+    if (!p)
+        return;
+    for (uint16_t i=1; i<CaptureEdges; i++)
+        p[i-1] = captureNextPeriod(&pos, &delta);
+    end = CaptureEdges - 1;
+    jitterAnalyse(p, &end, 1, &Jitter);
+    free(p);
+}
+
+// }}}
+// {{{ void jitRunEnd(uint32_t *ends, uint32_t *runs, uint32_t n)
+// close the current run of periods at n unless it is empty
+
+void jitRunEnd(uint32_t *ends, uint32_t *runs, uint32_t n)
+{
+    if (n > (*runs ? ends[*runs - 1] : 0))
+        ends[(*runs)++] = n;
+}
+
+// }}}
+// {{{ int jitterRing(char *path)
+// analyse the raw edges of a ring file. Periods are only taken between
+// edges of one gate: a gate start or a record lost to the writer ends the
+// run, the period across that gap is never bridged and every run is
+// analysed on its own time line.
+
+int jitterRing(char *path)
+{
+    struct ringHeader *h;
+    struct ringRecord *rec;
+    struct ringRecord  copy;
+    struct stat st;
+    uint64_t head;
+    uint64_t i;
+    uint32_t n = 0;
+    uint32_t runs = 0;
+    uint32_t t;
+    uint32_t prev = 0;
+    uint8_t  havePrev = FALSE;
+    double  *p;
+    uint32_t *ends;
+    int      fd;
+
+    fd = open(path, O_RDONLY);
+    if ((fd < 0) || fstat(fd, &st) || ((size_t)st.st_size < sizeof(struct ringHeader)))
+    {
+        perror(path);
+        return 1;
+    }
+    h = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if ((h == MAP_FAILED) || (memcmp(h->Magic, RING_MAGIC, 8) != 0))
+    {
+        fprintf(stderr, "%s: not a ring file\n", path);
+        return 1;
+    }
+    // the records have to be inside the file, a short one would fault
+    if ((h->HeaderSize < sizeof(struct ringHeader)) || (h->HeaderSize > (uint64_t)st.st_size) ||
+        (h->RecordSize != sizeof(struct ringRecord)) || (h->Capacity == 0) ||
+        (h->Capacity > ((uint64_t)st.st_size - h->HeaderSize) / sizeof(struct ringRecord)))
+    {
+        fprintf(stderr, "%s: damaged ring header\n", path);
+        munmap(h, st.st_size);
+        return 1;
+    }
+    rec = (struct ringRecord *)((uint8_t *)h + h->HeaderSize);
+    head = __atomic_load_n(&h->Head, __ATOMIC_ACQUIRE);
+    i = (head > h->Capacity) ? head - h->Capacity : 0;
+    p = malloc((head - i) * RING_EDGE_MAX * sizeof(double) + 1);
+    ends = malloc((head - i + 1) * sizeof(uint32_t));
+    if (!p || !ends)
+        return 1;
+
+    for (; i<head; i++)
+    {
+        // reader side of the ring protocol, skip records the writer lapped
+        struct ringRecord *r = &rec[i % h->Capacity];
+        if (__atomic_load_n(&r->Seq, __ATOMIC_ACQUIRE) != i + 1)
+        {
+            jitRunEnd(ends, &runs, n);
+            havePrev = FALSE;
+            continue;
+        }
+        memcpy(&copy, r, sizeof(copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&r->Seq, __ATOMIC_RELAXED) != i + 1)
+        {
+            jitRunEnd(ends, &runs, n);
+            havePrev = FALSE;
+            continue;
+        }
+        if (copy.Type != RING_EDGES)
+            continue;
+        // a new gate starts a new run of periods
+        if (copy.Payload[1])
+        {
+            jitRunEnd(ends, &runs, n);
+            havePrev = FALSE;
+        }
+        for (uint8_t k=0; (k < copy.Payload[0]) && (k < RING_EDGE_MAX); k++)
+        {
+            t = copy.Payload[4+4*k] | (copy.Payload[5+4*k] << 8) |
+                (copy.Payload[6+4*k] << 16) | ((uint32_t)copy.Payload[7+4*k] << 24);
+            if (havePrev)
+                p[n++] = (uint32_t)(t - prev);
+            prev = t;
+            havePrev = TRUE;
+        }
+    }
+    jitRunEnd(ends, &runs, n);
+    jitterAnalyse(p, ends, runs, &Jitter);
+    free(ends);
+    free(p);
+
+    printf("periods      %lu\n", (unsigned long)Jitter.Periods);
+    printf("mean period  %.3f ticks (%.6f Hz)\n", Jitter.MeanPeriod,
+        Jitter.MeanPeriod ? TIMEBASE_FREQUENCY / Jitter.MeanPeriod : 0);
+    printf("period       rms %.3f min %.0f max %.0f ticks\n", Jitter.PeriodRms, Jitter.PeriodMin, Jitter.PeriodMax);
+    printf("cycle-cycle  rms %.3f max %.0f ticks\n", Jitter.C2cRms, Jitter.C2cMax);
+    printf("TIE          rms %.3f pp %.3f ticks\n", Jitter.TieRms, Jitter.TiePP);
+    printf("spur         %.4f cycles/edge, %.3f ticks\n", Jitter.SpurFreq, Jitter.SpurAmp);
+    printf("histogram   ");
+    for (i=0; i<JIT_BINS; i++)
+        printf(" %lu", (unsigned long)Jitter.Hist[i]);
+    printf("\n");
+    return 0;
+}
+
+// }}}
+
+// }}}
+// {{{ Render cost harness
+// Runs a fixed script of mode changes and readings on the virtual clock
+// through the terminal frame queue, with the writer's write(2) replaced by
+// a counter, and prints the cost per frame. A frame is one mainLoop() plus
+// debug() pass and its termFrame(), as in main().
+
+// {{{ ssize_t renderWrite(int fd, const void *data, size_t size)
+
+ssize_t renderWrite(int fd, const void *data, size_t size)
+{
+    const char *buf = data;
 
-    initDisplay();
-    initMultiplexers();
-    initMenu();
-    initMeasuring();
+    Render.Writes++;
+    Render.Bytes += size;
+    for (size_t i=0; i<size; i++)
+    {
+        // ESC [ row ; col f  (or H) is one cursor move
+        char c = buf[i];
+        if (c == '\033')
+            Render.Esc = 1;
+        else if ((Render.Esc == 1) && (c == '['))
+            Render.Esc = 2;
+        else if ((Render.Esc == 2) && (isdigit(c) || (c == ';')))
+            ;
+        else
+        {
+            if ((Render.Esc == 2) && ((c == 'f') || (c == 'H')))
+                Render.Moves++;
+            Render.Esc = 0;
+        }
+    }
+    return size;
 }
 
 // }}}
-// {{{  void outit(void)
+// {{{ void renderSync(void)
+// queue the frame and wait until the writer is through with it, so no frame
+// is skipped and the counts are the same every run
 
-void outit(void)
+void renderSync(void)
 {
-#ifdef TESTING
-    deSetCursorPosition(33,1); 
-    printf("\r\nReciproke Counter Finished\r\n");
-#endif
+    termFrame();
+    while (__atomic_load_n(&Term.Tail, __ATOMIC_ACQUIRE) != Term.Head)
+        sched_yield();
 }
 
 // }}}
+// {{{ void renderFrames(const char *stage, const char *keys, uint16_t frames)
+// one frame per key (0 for none) followed by reading frames
 
-void initMultiplexers(void)
-{/*{{{*/
-}/*}}}*/
+void renderFrames(const char *stage, const char *keys, uint16_t frames)
+{
+    struct renderCount start;
+    uint32_t n = 0;
 
-void initDisplay(void)
-{/*{{{*/
-    deClearScreen();
-    layo_BackGround();
-}/*}}}*/
+    start = Render;
+    do
+    {
+        if (*keys)
+            keyPut(*keys++);
+        for (uint16_t i=0; i<frames; i++, n++)
+        {
+            mainLoop();
+            debug();
+            renderSync();
+        }
+    }
+    while (*keys);
+    fprintf(stderr, "%s_bytes %.2f\n", stage, (double)(Render.Bytes - start.Bytes) / n);
+    fprintf(stderr, "%s_writes %.2f\n", stage, (double)(Render.Writes - start.Writes) / n);
+    fprintf(stderr, "%s_moves %.2f\n", stage, (double)(Render.Moves - start.Moves) / n);
+}
 
-void initMenu(void)
-{/*{{{*/
-    layo_bgmodemenu();
-    layo_bg_inputs();
-    layo_bg_buttons_main();
-}/*}}}*/
+// }}}
+// {{{ int renderBench(void)
+// results go to stderr, the real stdout only gets the final repaint
 
-void initMeasuring(void)
-{/*{{{*/
-}/*}}}*/
+int renderBench(void)
+{
+    struct renderCount start;
+
+    StatePath = NULL;                       // cold start, same every run
+    SimClockMode = SIM_JUMP;
+    OutputMode = OUT_TUI;
+    Term.Out = renderWrite;
+    termStart();
+    if (!Term.Tty)
+        return 1;
+
+    // background: what init() draws
+    start = Render;
+    initDisplay();
+    initMenu();
+    renderSync();
+    fprintf(stderr, "background_bytes %lu\n", (unsigned long)(Render.Bytes - start.Bytes));
+    fprintf(stderr, "background_writes %lu\n", (unsigned long)(Render.Writes - start.Writes));
+    fprintf(stderr, "background_moves %lu\n", (unsigned long)(Render.Moves - start.Moves));
+
+    persistLoad();
+    initMeasuring();
+    renderFrames("reading", "", RENDER_READINGS);
+    renderFrames("mode", "phleri76gdmf", 1);
+    renderFrames("hold", "cc", 1);
+    termStop();
+    return 0;
+}
 
 // }}}
-// {{{ int main(void)
 
-int main(void)
+// }}}
+#endif
+
+// }}}
+// {{{ Persistent state
+// Last command register and autorange state for a warm start. Records
+// rotate over EE_SLOTS slots for wear levelling; the simulator keeps the
+// same image in a state file.
+
+// {{{ uint8_t eeCrc(uint8_t *rec)
+
+uint8_t eeCrc(uint8_t *rec)
 {
-    init();
-    while (!ExitMainLoop)
+    uint8_t crc = 0x5A;
+    for (uint8_t i=0; i<EE_SLOT_SIZE-1; i++)
     {
-        mainLoop();
-        debug();
+        crc ^= rec[i];
+        for (uint8_t j=0; j<8; j++)
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
     }
-    outit();
+    return crc;
 }
 
 // }}}
-// {{{ void mainLoop(void)
-// {{ MainLoop code
+// {{{ uint8_t eeReadSlot(uint8_t slot, uint8_t *rec)
+// returns FALSE on an erased or damaged slot
 
-void mainLoop(void)
+uint8_t eeReadSlot(uint8_t slot, uint8_t *rec)
 {
 #ifdef TESTING
-    static uint32_t prevTime;
-    char c;
-    if (FHEkbhit())
+    memcpy(rec, EeImage + slot * EE_SLOT_SIZE, EE_SLOT_SIZE);
+#else
+    eeprom_read_block(rec, (const void *)(uintptr_t)(EE_BASE + slot * EE_SLOT_SIZE), EE_SLOT_SIZE);
+#endif
+    return eeCrc(rec) == rec[EE_SLOT_SIZE-1];
+}
+
+// }}}
+// {{{ void persistLoad(void)
+
+void persistLoad(void)
+{
+    uint8_t rec[EE_SLOT_SIZE];
+    uint8_t next[EE_SLOT_SIZE];
+    uint8_t i;
+
+#ifdef TESTING
+    FILE *f;
+    memset(EeImage, 0xFF, EE_SIZE);
+    if (StatePath && ((f = fopen(StatePath, "rb")) != NULL))
     {
-        c = FHEgetchar();
-        deSetCursorPosition(20,1);
-        parseCommand(c);
+        if (fread(EeImage, 1, EE_SIZE, f) != EE_SIZE)
+            memset(EeImage, 0xFF, EE_SIZE);
+        fclose(f);
     }
-    //printf("a\n");
-    updateAppClock();
-
 #endif
-    //printf("b\n");
-    if (CommandRegisterChanged)
+    EeSlot = EE_SLOTS - 1;
+    EeSeq = 0xFF;
+    for (i=0; i<EE_SLOTS; i++)
     {
-        CommandRegisterChanged = FALSE;
-        setupCommandExecution();
-        //printf("c\n");
-        setupDisplay();
-        //printf("d\n");
+        if (!eeReadSlot(i, rec))
+            continue;
+        if (eeReadSlot((i + 1) % EE_SLOTS, next) && (next[0] == (uint8_t)(rec[0] + 1)))
+            continue;
+        EeSlot = i;
+        EeSeq = rec[0];
+        CommandRegister = rec[1];
+        Meas.DividerSetting = rec[2];
+        Meas.TimeBasePulsTest = (uint32_t)rec[3] | (uint32_t)rec[4] << 8 |
+                           (uint32_t)rec[5] << 16 | (uint32_t)rec[6] << 24;
+        Meas.RangeValid = (Meas.TimeBasePulsTest != 0);
+        break;
     }
+}
+
+// }}}
+// {{{ void persistSave(void)
+
+void persistSave(void)
+{
+    uint8_t rec[EE_SLOT_SIZE];
+
+    EeSlot = (EeSlot + 1) % EE_SLOTS;
+    rec[0] = ++EeSeq;
+    rec[1] = CommandRegister;
+    rec[2] = Meas.RangeValid ? Meas.DividerSetting : 0;
+    putLE(rec + 3, Meas.RangeValid ? Meas.TimeBasePulsTest : 0, 4);
+    rec[EE_SLOT_SIZE-1] = eeCrc(rec);
 #ifdef TESTING
-    if ((OurTime - prevTime) > 1)   // larger then 1 sec
+    FILE *f;
+    char  tmp[512];
+    struct stat st;
+    memcpy(EeImage + EeSlot * EE_SLOT_SIZE, rec, EE_SLOT_SIZE);
+    if (!StatePath)
+        return;
+    // a character device is written in place, renaming would replace it
+    if ((stat(StatePath, &st) == 0) && !S_ISREG(st.st_mode))
     {
-        prevTime = OurTime;
-        InputSignal = 48000L;
-#endif
-        sampleMeasurement();
-        finalMeasurement();
-        getCounterValue();
-        calculateDisplayValue();
-        showValueOnDisplay();
-#ifdef TESTING
+        if ((f = fopen(StatePath, "wb")) != NULL)
+        {
+            fwrite(EeImage, 1, EE_SIZE, f);
+            fclose(f);
+        }
+        return;
+    }
+    // write a new file and rename it over the old one, a crash leaves
+    // either the old or the new image but never a truncated one
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", StatePath) >= (int)sizeof(tmp))
+        return;
+    if ((f = fopen(tmp, "wb")) == NULL)
+        return;
+    if ((fwrite(EeImage, 1, EE_SIZE, f) != EE_SIZE) || (fflush(f) != 0) || (fsync(fileno(f)) != 0))
+    {
+        fclose(f);
+        unlink(tmp);
+        return;
     }
+    fclose(f);
+    if (rename(tmp, StatePath) != 0)
+        unlink(tmp);
+#else
+    eeprom_update_block(rec, (void *)(uintptr_t)(EE_BASE + EeSlot * EE_SLOT_SIZE), EE_SLOT_SIZE);
 #endif
 }
 
-// }}
 // }}}
+// {{{ void persistService(void)
+// save changed state once it has been left alone for EE_SETTLE, a burst
+// of key presses costs one write
 
-// {{{ void setupCommandExecution(void)
-
-void setupCommandExecution(void)
+void persistService(void)
 {
-    uint16_t mode;
-
-    mode = CommandRegister & MASK_MODE;
-    switch (mode)
+    if (EeDirty)
     {
-        case cFREQUENCY :
-
-            break;
-
-        case cPERIOD    :
-
-            break;
-
-        case cPULSEHI   :
-
-            break;
-
-        case cPULSELO   :
-
-            break;
+        EeDirty = FALSE;
+        EePending = TRUE;
+        EeTime = OurTime;
+    }
+    if (EePending && ((OurTime - EeTime) >= EE_SETTLE))
+        persistFlush();
+}
 
-        case cEVENT     :
+// }}}
+// {{{ void persistFlush(void)
+// write pending state now
 
-            break;
+void persistFlush(void)
+{
+    uint8_t rec[EE_SLOT_SIZE];
+
+    if (!EeDirty && !EePending)
+        return;
+    EeDirty = FALSE;
+    EePending = FALSE;
+    // skip the write when nothing changed since the newest record
+    if (eeReadSlot(EeSlot, rec) && (rec[1] == CommandRegister) &&
+        (rec[2] == (Meas.RangeValid ? Meas.DividerSetting : 0)))
+        return;
+    persistSave();
+}
 
-        case iGHZ       : 
+// }}}
 
-            break;
+// }}}
+#ifdef BENCHMARK
+// {{{ Cycle benchmark
+// Run under simavr: Timer1 counts CPU cycles (CaptureHigh:TCNT1) and the
+// results go to the simavr console register, one "bench <stage> <cycles>"
+// line per pipeline stage. The capture handlers run for real, the
+// firmware drives the ICP1 and INT0 pins itself and both fire on output
+// pins. The load lines add up the handlers that can fall into one
+// capture spacing, make avr-bench fails when one exceeds its budget line.
+// The firmware stops by sleeping with interrupts off, which ends the
+// simulation.
+
+AVR_MCU(F_CPU, "atmega328p");
+AVR_MCU_SIMAVR_CONSOLE(&GPIOR0);
+
+int benchPutc(char c, FILE *f)
+{
+    GPIOR0 = c;
+    return 0;
+}
 
-        case iMHz       : 
+FILE BenchOut = FDEV_SETUP_STREAM(benchPutc, NULL, _FDEV_SETUP_WRITE);
 
-            break;
+// {{{ uint32_t benchCycles(void)
 
-        case iDIGITAL   : 
+uint32_t benchCycles(void)
+{
+    uint16_t lo;
+    uint16_t hi;
+    ATOMIC_BLOCK(ATOMIC_FORCEON)
+    {
+        lo = TCNT1;
+        hi = CaptureHigh;
+        if ((TIFR1 & _BV(TOV1)) && (lo < 0x8000))
+            hi++;
+    }
+    return ((uint32_t)hi << 16) | lo;
+}
 
-            break;
+// }}}
+// {{{ void benchmark(void)
 
-        case iP6DIGITS  :
-            if ((CommandRegister & MASK_DIGITS) == FALSE)
-                break;
+#define BENCH(name, stmt)                                               \
+    do {                                                                \
+        uint32_t t0 = benchCycles();                                    \
+        stmt;                                                           \
+        cycles = benchCycles() - t0 - overhead;                         \
+        benchPrint(PSTR(name), cycles);                                 \
+    } while (0)
 
-        case iP7DIGITS  :
-            if ((CommandRegister & MASK_DIGITS) == TRUE)
-                break;
-    }
-    CommandRegisterChanged = FALSE;
+void benchPrint(const char *name, uint32_t cycles)
+{
+    fprintf_P(&BenchOut, PSTR("bench %S %lu\n"), name, (unsigned long)cycles);
 }
 
-// }}}            
-// {{{ void setupDisplay(void)
-
-void setupDisplay(void)
+void benchmark(void)
 {
-    layo_BackGround();
+    uint32_t overhead = 0;
+    uint32_t cycles;
+    uint32_t hold;
+    uint32_t channelB;
+    uint32_t other;
+    uint16_t t0;
+    char     str[14];
+
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10);
+    TIMSK1 = _BV(TOIE1);
+    sei();
+    stdout = &DisplayOut;
+
+    overhead = benchCycles();
+    overhead = benchCycles() - overhead;
+
+    CommandRegister = P7DIGITS + FREQUENCY + MHZ;
+    Meas.Precision = 7;
+    Meas.TimeBasePulsTest = BENCH_PERIOD / 2;
+    Meas.DividerSetting = 1;
+    Meas.RangeValid = TRUE;
+
+    BENCH("regAddSample", regAddSample(&Meas.Reg, 12345));
+    BENCH("calculateGateTime", calculateGateTime());
+    BENCH("finalMeasurement", finalMeasurement());
+    BENCH("checkRange", checkRange());
+    BENCH("regFrequencyMilliHz", regFrequencyMilliHz(&Meas.Reg, Meas.PortPrescaler));
+    BENCH("calculateDisplayValue", calculateDisplayValue());
+    BENCH("formatDecimal", formatDecimal(str, Meas.DisplayValue, Meas.DecimalPosition));
+    BENCH("showValueOnDisplay", showValueOnDisplay());
+    // the frame stays in the TX ring, draining it is not part of the stage
+    StreamEnabled = TRUE;
+    BENCH("streamReading", { cli(); streamReading(); UCSR0B &= ~_BV(UDRIE0); sei(); });
+
+    // capture handlers from the pin write to their return, an open gate
+    // that takes every edge into the fit
+    gateReset();
+    Meas.GateTimeFinal = GATE_MAX_TICKS;
+    Meas.Reg.Stride = 1;
+    Meas.RegB.Stride = 1;
+    GateOpen = TRUE;
+    captureChannelA(benchCycles());
+    TCCR1B = _BV(ICES1) | _BV(CS10);
+    TIFR1 = _BV(ICF1);
+    TIMSK1 = _BV(ICIE1) | _BV(TOIE1);
+    DDRB |= _BV(PB0);
+    PORTB &= ~_BV(PB0);
+    BENCH("isrCapture", { PORTB |= _BV(PB0); __asm__ volatile ("nop"); });
+    PORTB &= ~_BV(PB0);
+    captureReset();
+    Capturing = TRUE;
+    BENCH("isrCaptureHold", { PORTB |= _BV(PB0); __asm__ volatile ("nop"); });
+    hold = cycles;
+    PORTB &= ~_BV(PB0);
+    Capturing = FALSE;
+
+    // channel B closing an A->B interval; the latency is counted from
+    // the TCNT1 read before the pin write, less the rest of that read and
+    // the write itself
+    EICRA = _BV(ISC01) | _BV(ISC00);
+    DDRD |= _BV(PD2);
+    PORTD &= ~_BV(PD2);
+    EIFR = _BV(INTF0);
+    EIMSK = _BV(INT0);
+    LastAValid = TRUE;
+    BENCH("isrChannelB", { PORTD |= _BV(PD2); __asm__ volatile ("nop"); });
+    channelB = cycles;
+    PORTD &= ~_BV(PD2);
+    EIMSK = _BV(INT0);
+    LastBValid = FALSE;
+    t0 = TCNT1;
+    PORTD |= _BV(PD2);
+    __asm__ volatile ("nop");
+    benchPrint(PSTR("int0Latency"), (uint16_t)(LastB + INT0_LATENCY - t0 - 4));
+    EIMSK = 0;
+    GateOpen = FALSE;
+
+    // the other handlers, called directly; the hardware adds 7 cycles of
+    // interrupt response and vector jump. The display handler sends an
+    // address command refilled from a dirty cell, its longest path.
+    BENCH("isrTick", TIMER0_COMPA_vect());
+    other = cycles + 7;
+    LcdBusy = 0;
+    LcdHead = LcdTail;
+    LcdScan = 0;
+    LcdAddress = 0xFF;
+    LcdDirty[0][0] = TRUE;
+    BENCH("isrDisplay", TIMER2_COMPA_vect());
+    if (cycles + 7 > other)
+        other = cycles + 7;
+
+    // a capture may wait for one other handler and has to be done before
+    // the next one; in the dual modes B comes in between as well
+    benchPrint(PSTR("loadSingle"), hold + other);
+    benchPrint(PSTR("budgetSingle"), REG_MIN_SPACING);
+    benchPrint(PSTR("loadDual"), hold + channelB + other);
+    benchPrint(PSTR("budgetDual"), DUAL_MIN_SPACING);
+
+    cli();
+    sleep_enable();
+    sleep_cpu();
 }
 
 // }}}
 
-// {{{ void sampleMeasurement(void);
+// }}}
+#endif
+#ifndef TESTING
+// {{{ Tick interrupt
 
-void sampleMeasurement(void)
+ISR(TIMER0_COMPA_vect)
 {
-    printf("1a\n");
-    PortPrescaler = 2; // (for the first sample measurement
-#ifdef TESTING
-    {
-        // GateFreq = InputSignal / PortPrescaler; 
-        // GateTime = GatePeriod / 2
-        // GateTime = 1 / (GateFreq * 2)
-        // CounterValue = TIMEBASE_FREQUENCY * GateTime
-        // CounterValue = TIMEBASE_FREQUENCY / (GateFreq * 2)
-        // CounterValue = TIMEBASE_FREQUENCY / ((InputSignal/PortPrescaler) * 2)
-        CounterValue = (TIMEBASE_FREQUENCY * PortPrescaler) / (InputSignal * 2);
-        printf("1b\n");
-        TimeBasePulsTest = CounterValue;
-        printf("1c\n");
-        DividerSetting = getDividerSetting(TimeBasePulsTest);
-        printf("1d\n");
-    }
-
-#endif
+    IRQ_Ticks++;
+    keyScan(~PINB >> PB1);
+    IsrDone = TCNT1;
 }
 
 // }}}
-// {{{ void finalMeasurement(void);
+// {{{ Display interrupt
 
-void finalMeasurement(void)
+ISR(TIMER2_COMPA_vect)
 {
-    printf("2a\n");
-    PortPrescaler = 1 << DividerSetting;
-    printf("%llu\n" ,PortPrescaler);
-    printf("2b\n");
-    CounterValue =  (TIMEBASE_FREQUENCY * PortPrescaler);
-    printf("2c\n");
-    uint64_t tmp = (InputSignal * 2);
-    printf("2d\n");
-    CounterValue = CounterValue / tmp;
-    printf("2e\n");
-    TimeBasePulsFinal = CounterValue;
-    printf("2f\n");
+    lcdService();
+    IsrDone = TCNT1;
 }
 
 // }}}
-// {{{ void getCounterValue(void)
+// {{{ Capture interrupts
+// Timer1 counts the timebase (the CPU clock), ICP1 latches the prescaled input
 
-void getCounterValue(void)
+ISR(TIMER1_OVF_vect)
 {
-    CounterValue = TimeBasePulsFinal;
+    CaptureHigh++;
+    IsrDone = TCNT1;
 }
 
-// }}}
-// {{{ void calculateDisplayValue(void)
+ISR(TIMER1_CAPT_vect)
+{
+    uint16_t lo = ICR1;
+    uint16_t hi = CaptureHigh;
+    // overflow pending but not yet serviced
+    if ((TIFR1 & _BV(TOV1)) && (lo < 0x8000))
+        hi++;
+    if (Capturing && !captureAddEdge(((uint32_t)hi << 16) | lo))
+        Capturing = FALSE;
+    if (GateOpen)
+        captureChannelA(((uint32_t)hi << 16) | lo);
+    IsrDone = TCNT1;
+}
 
-void calculateDisplayValue(void)
+ISR(INT0_vect)
 {
-    printf("3a\n");
-    DisplayValue = (TIMEBASE_FREQUENCY * PortPrescaler);
-    printf("3b\n");
-    //DisplayValue =  DisplayValue / TimeBasePulsFinal;
-    printf("3c\n");
+    uint16_t lo = TCNT1;
+    uint16_t hi = CaptureHigh;
+    if ((TIFR1 & _BV(TOV1)) && (lo < 0x8000))
+        hi++;
+    // software timestamp, take off the fixed interrupt latency
+    if (GateOpen)
+        captureChannelB((((uint32_t)hi << 16) | lo) - INT0_LATENCY, (uint16_t)(lo - IsrDone) < INT0_HOLDOFF);
+    // off outside the gate and above the rate limit, gateReset() turns it on
+    if (!GateOpen || Meas.BTooFast)
+        EIMSK = 0;
 }
 
 // }}}
-// {{{ void showValueOnDisplay(void)
+// {{{ USART interrupt
 
-void showValueOnDisplay(void)
+ISR(USART_UDRE_vect)
 {
-
-    printf("4\n");
-    //if (PrevValue != DisplayValue)
-    {
-        layo_ShowValue(DisplayValue,3);
-        PrevValue = DisplayValue;
-    }
+    if (TxTail == TxHead)
+        UCSR0B &= ~_BV(UDRIE0);
+    else
+        UDR0 = TxBuf[TxTail++];
+    IsrDone = TCNT1;
 }
 
 // }}}
+#endif
+// {{{ uint64_t mulDiv64(uint64_t a, uint64_t b, uint64_t c)
+// a * b / c with a 128 bit intermediate, the quotient must fit in 64 bits
 
-// {{{ uint8_t getDividerSetting(pulses)
-
-uint8_t getDividerSetting(uint64_t pulses)
+uint64_t mulDiv64(uint64_t a, uint64_t b, uint64_t c)
 {
-    uint8_t  n = 0;
-    uint64_t divided;
-    do  
+    uint64_t ll = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+    uint64_t lh = (a & 0xFFFFFFFF) * (b >> 32);
+    uint64_t hl = (a >> 32) * (b & 0xFFFFFFFF);
+    uint64_t hh = (a >> 32) * (b >> 32);
+    uint64_t mid = (ll >> 32) + (lh & 0xFFFFFFFF) + (hl & 0xFFFFFFFF);
+    uint64_t lo = (ll & 0xFFFFFFFF) | (mid << 32);
+    uint64_t r  = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+    uint64_t q  = 0;
+    uint8_t  top;
+
+    for (int i=0; i<64; i++)
     {
-        n++;
-        divided  = pulses << n;
+        top = r >> 63;
+        r = (r << 1) | (lo >> 63);
+        lo <<= 1;
+        q <<= 1;
+        if (top || (r >= c))
+        {
+            r -= c;
+            q |= 1;
+        }
     }
-    while ((divided < 1000000) && (n<31));
-    return n;
+    return q;
 }
 
 // }}}
-// {{{ char *getMode(void)
 
-char *getMode(void)
+// }}}
+// {{{ const char *getMode(void)
+// pointer into flash
+
+const char *getMode(void)
 {
     int m = (CommandRegister & MASK_MODE) >> 2;
     return ModeString[m];
 }
 
 // }}}
-// {{{ char *getUnits(void)
+// {{{ const char *getUnits(void)
+// pointer into flash
 
-char *getUnits(void)
+const char *getUnits(void)
 {
     int u;
     switch (CommandRegister & MASK_MODE) 
     {
         case FREQUENCY :
-            u=3; 
-            break;
         case PERIOD :
         case PULSELO :
         case PULSEHI :
-            u=7; 
+        case INTERVAL :
+        case BURST :
+            u=Meas.UnitIndex; 
             break;
-        case EVENT :
+        default :
             u=9; 
             break;
     }
@@ -857,9 +4340,8 @@ uint32_t sysClock(void)
 {       
     register uint32_t rv;
 #ifdef TESTING
-    // posix clock works in uS
-    // dividing by 10000 converts to centiseconds
-    rv = clock() / 10000L;
+    // virtual timebase ticks to centiseconds
+    rv = SimTime / (TIMEBASE_FREQUENCY / 100);
 #else
     // Atmel timer setup uses approximate centiseconds
     ATOMIC_BLOCK(ATOMIC_FORCEON)
@@ -875,6 +4357,10 @@ uint32_t sysClock(void)
 
 void updateAppClock(void)
 {
+#ifdef TESTING
+    simClockSync();
+    simKeyTicks();
+#endif
     OurTime = sysClock();
 }
 
@@ -884,13 +4370,61 @@ void updateAppClock(void)
 
 #define VALUELINE 6
 
+// formatted output with the format string kept in flash
+#define layo_printf(fmt, ...) printf_P(PSTR(fmt), ##__VA_ARGS__)
+
+// {{{ void layo_puts_P(const char *str)
+
+void layo_puts_P(const char *str)
+{
+    char c;
+    while ((c = pgm_read_byte(str++)) != 0)
+        deData(c);
+}
+
+// }}}
+
 // {{{ void layo_ShowValue(uint32_t value, int decPos)
 
 void layo_ShowValue(uint32_t value, short decimalPosition)
 {
+    char  str[14];
+    short n;
+    short i;
+
+    n = Meas.ValueValid ? formatDecimal(str, value, decimalPosition) : 0;
     deSetCursorPosition(VALUELINE,30); 
-    printf("%4d.%d", value/1000, value%1000);
-    printf(" ");
+    for (i=n; i<Meas.Precision+2; i++)
+        deData(' ');
+    for (i=0; i<n; i++)
+        deData(str[i]);
+}
+
+// }}}
+// {{{ short formatDecimal(char *str, uint32_t value, short decimalPosition)
+// value with the decimal point inserted, returns the length
+
+short formatDecimal(char *str, uint32_t value, short decimalPosition)
+{
+    char  digits[12];
+    short n=0;
+    short j=0;
+
+    // least significant first, at least one digit before the point
+    do
+    {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    }
+    while (value || (n <= decimalPosition));
+    while (n--)
+    {
+        str[j++] = digits[n];
+        if ((decimalPosition > 0) && (n == decimalPosition))
+            str[j++] = '.';
+    }
+    str[j] = 0;
+    return j;
 }
 
 // }}}
@@ -898,23 +4432,24 @@ void layo_ShowValue(uint32_t value, short decimalPosition)
 
 void layo_BackGround(void)
 {
-    layo_bg_title("PA3BJI Reciproke Counter");
+    layo_bg_title(PSTR("PA3BJI Reciproke Counter"));
     layo_bgmodemenu();
     layo_bg_inputs();
     layo_bg_buttons_main();
     layo_bg_mode(getMode());
     layo_bg_units(getUnits());
-    printf("\n");
+    layo_ShowCapture();
+    layo_printf("\n");
 }
 
 
 // }}}
-// {{{ void layo_bg_title(char *title)
+// {{{ void layo_bg_title(const char *title)
 
-void layo_bg_title(char *title)
+void layo_bg_title(const char *title)
 {
     deSetCursorPosition(1,1); 
-    printf("%s",title);
+    layo_puts_P(title);
 }
 
 // }}}
@@ -926,16 +4461,16 @@ void layo_bgmodemenu(void)
     short col=1;
     deSetColor(97,44);
     deSetCursorPosition(row,col); 
-    printf("%s", measurements[0]);
+    layo_puts_P(measurements[0]);
     deClearColor();
     for (int i=2; i<MEASURCNT; i++)
     {
         row++;
         deSetCursorPosition(row,col); 
-        printf("%s",measurements[1]);
+        layo_puts_P(measurements[1]);
         row++;
         deSetCursorPosition(row,col); 
-        printf("%s",measurements[i]);
+        layo_puts_P(measurements[i]);
     }
 }
 
@@ -948,21 +4483,21 @@ void layo_bg_inputs(void)
     short col=50;
     deSetColor(97,44);
     deSetCursorPosition(row,col); 
-    printf("%s", InputString[0]);
+    layo_puts_P(InputString[0]);
     deClearColor();
     row++;
     deSetCursorPosition(row,col); 
-    printf("%s", InputString[1]);
+    layo_puts_P(InputString[1]);
     for (int i=2; i<INPUTCNT; i++)
     {
         row++;
         deSetCursorPosition(row,col); 
-        printf("%s",InputString[i]);    
+        layo_puts_P(InputString[i]);    
         for (int j=0; j<2; j++)
         {
             row++;
             deSetCursorPosition(row,col); 
-            printf("%s", InputString[1]);
+            layo_puts_P(InputString[1]);
         }
     }
 }
@@ -972,34 +4507,93 @@ void layo_bg_inputs(void)
 
 void layo_bg_buttons_main(void)
 {
-    deSetCursorPosition(16, 3); 
-    printf("Setup");
-    deSetCursorPosition(16,25); 
-    printf("6/7 digts");
-    deSetCursorPosition(16,51); 
-    printf("hold/Cont");
+    deSetCursorPosition(21, 3); 
+    layo_puts_P(PSTR("Setup"));
+    deSetCursorPosition(21,25); 
+    layo_puts_P(PSTR("6/7 digts"));
+    deSetCursorPosition(21,51); 
+    layo_puts_P(PSTR("hold/Cont"));
 }
 
 // }}}
-// {{{ void layo_bg_mode(char *modeStr)
+// {{{ void layo_ShowCapture(void)
 
-void layo_bg_mode(char *modeStr)
+void layo_ShowCapture(void)
+{
+    deSetCursorPosition(VALUELINE+2,18); 
+    if (!Hold && BurstMode)
+        layo_printf("sub-gate %4lu +%5lu us        ",
+            (unsigned long)(Meas.BurstDelay / (TIMEBASE_FREQUENCY / 1000000)),
+            (unsigned long)(Meas.BurstWidth / (TIMEBASE_FREQUENCY / 1000000)));
+    else if (!Hold)
+        layo_printf("%-30s", "");
+    else if (!CaptureAnalysed)
+        layo_printf("Hold, capturing               ");
+    else
+        layo_printf("Hold %4u edges %4u bytes     ", CaptureEdges, CaptureLen);
+    deSetCursorPosition(VALUELINE+3,18); 
+    if (Hold && CaptureAnalysed)
+        layo_printf("min %lu max %lu mean %lu ticks, max dev @%u    ",
+            (unsigned long)CaptureMinPeriod, (unsigned long)CaptureMaxPeriod,
+            (unsigned long)CaptureMeanPeriod, CaptureMaxEdge);
+    else
+        layo_printf("%-50s", "");
+#ifdef TESTING
+    layo_ShowJitter();
+#endif
+}
+
+// }}}
+#ifdef TESTING
+// {{{ void layo_ShowJitter(void)
+
+void layo_ShowJitter(void)
+{
+    double ns = 1e9 / TIMEBASE_FREQUENCY;
+    uint8_t show = Hold && CaptureAnalysed && Jitter.Periods;
+
+    deSetCursorPosition(VALUELINE+4,18); 
+    if (show)
+        printf("jitter %7.2f  c2c %7.2f ns   ", Jitter.PeriodRms * ns, Jitter.C2cRms * ns);
+    else
+        printf("%-31s", "");
+    deSetCursorPosition(VALUELINE+5,18); 
+    if (show)
+        printf("TIE %7.2f rms %8.2f pp ns ", Jitter.TieRms * ns, Jitter.TiePP * ns);
+    else
+        printf("%-31s", "");
+    deSetCursorPosition(VALUELINE+6,18); 
+    if (show)
+        printf("spur %9.1f Hz %7.2f ns   ",
+            Jitter.SpurFreq * TIMEBASE_FREQUENCY / Jitter.MeanPeriod, Jitter.SpurAmp * ns);
+    else
+        printf("%-31s", "");
+}
+
+// }}}
+#endif
+// {{{ void layo_bg_mode(const char *modeStr)
+
+void layo_bg_mode(const char *modeStr)
 {
     deSetCursorPosition(VALUELINE,18); 
-    printf(" %s",modeStr);
+    deData(' ');
+    layo_puts_P(modeStr);
 }
 // }}}
-// {{{ void layo_bg_units(char *unitStr)
+// {{{ void layo_bg_units(const char *unitStr)
 
-void layo_bg_units(char *unitStr)
+void layo_bg_units(const char *unitStr)
 {
     deSetCursorPosition(VALUELINE,40); 
-    printf(" %s",unitStr);
+    deData(' ');
+    layo_puts_P(unitStr);
 }
 // }}}
 
 // }}}
 
+#ifdef TESTING
 // {{{ void printCmdReg()
 
 void printCmdReg(void)
@@ -1024,29 +4618,36 @@ void printCmdReg(void)
 
 void debug(void)
 {
-    int topDbg=20;
+    int topDbg=22;
+    if (OutputMode != OUT_TUI)
+        return;
     deSetCursorPosition(topDbg++,1); printf("CmdReg=$%04X"           , CommandRegister);
     deSetCursorPosition(topDbg++,1); printf("CmdReg=");                printCmdReg();
     deSetCursorPosition(topDbg++,1); printf("OurTime=%d sec"         , OurTime); 
-    deSetCursorPosition(topDbg++,1); printf("CounterValue=%8llu             " , CounterValue); 
-    deSetCursorPosition(topDbg++,1); printf("DisplayValue=%8llu             " , DisplayValue); 
-    deSetCursorPosition(topDbg++,1); printf("PortPrescaler=%8llu            " , PortPrescaler); 
-    deSetCursorPosition(topDbg++,1); printf("DividerSetting=%d              " , DividerSetting); 
+    deSetCursorPosition(topDbg++,1); printf("SimTime=%llu ticks, due %llu   ", (unsigned long long)SimTime, (unsigned long long)SimGateDue); 
+    deSetCursorPosition(topDbg++,1); printf("CounterValue=%8lu             " , (unsigned long)Meas.CounterValue); 
+    deSetCursorPosition(topDbg++,1); printf("DisplayValue=%8lu             " , (unsigned long)Meas.DisplayValue); 
+    deSetCursorPosition(topDbg++,1); printf("PortPrescaler=%8lu            " , (unsigned long)Meas.PortPrescaler); 
+    deSetCursorPosition(topDbg++,1); printf("DividerSetting=%d              " , Meas.DividerSetting); 
 
-    deSetCursorPosition(topDbg++,1); printf("InputSignal=%8llu              " , InputSignal); 
+    deSetCursorPosition(topDbg++,1); printf("InputSignal=%8llu              " , (unsigned long long)InputSignal); 
 
-    deSetCursorPosition(topDbg++,1); printf("GateTime Test=%8llu            " , GateTimeTest); 
-    deSetCursorPosition(topDbg++,1); printf("TimeBasePulsTest=%8llu         " , TimeBasePulsTest); 
+    deSetCursorPosition(topDbg++,1); printf("TimeBasePulsTest=%8lu         " , (unsigned long)Meas.TimeBasePulsTest); 
 
 
-    deSetCursorPosition(topDbg++,1); printf("GateTime Final=%8llu           " , GateTimeFinal); 
-    deSetCursorPosition(topDbg++,1); printf("TimeBasePulsFinal=%8llu        " , TimeBasePulsFinal); 
+    deSetCursorPosition(topDbg++,1); printf("GateTime Final=%8lu           " , (unsigned long)Meas.GateTimeFinal); 
+    deSetCursorPosition(topDbg++,1); printf("TimeBasePulsFinal=%8lu        " , (unsigned long)Meas.TimeBasePulsFinal); 
+    deSetCursorPosition(topDbg++,1); printf("RangeValid=%s EeSlot=%2u   " , yesno(Meas.RangeValid), EeSlot); 
+    deSetCursorPosition(topDbg++,1); printf("Bursts=%u Edges=%lu Ticks=%llu   " , Meas.Bursts, (unsigned long)Meas.BurstEdges, (unsigned long long)Meas.BurstTicks); 
+    deSetCursorPosition(topDbg++,1); printf("B Samples=%6u Stride=%u Intervals=%lu late=%u%s   " , Meas.RegB.N, Meas.RegB.Stride, (unsigned long)Meas.IntervalN, Meas.IntervalLate, Meas.BTooFast ? " too fast" : ""); 
+    deSetCursorPosition(topDbg++,1); printf("Samples=%6u Stride=%u Noise=%6.3f   " , Meas.Reg.N, Meas.Reg.Stride, Meas.NoiseTicks); 
 
-    deSetCursorPosition(topDbg++,1); printf("intermediate=%8llu             " , PortPrescaler*TIMEBASE_FREQUENCY); 
+    deSetCursorPosition(topDbg++,1); printf("intermediate=%8llu             " , (unsigned long long)Meas.PortPrescaler*TIMEBASE_FREQUENCY); 
 
 }
 
 // }}}
+#endif
 
 // {{{
 // }}}